@@ -1,39 +1,697 @@
+// STL Header
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
 
 #include "HttpClient.h"
 
+#pragma region LatencyHistogram
+/**
+ * HDR-style histogram of latency in microseconds, the values are kept with 3 significant digits.
+ * Values from 0 to 2047 have their own bucket, and each power of 2 range above has 1024 buckets.
+ */
+class LatencyHistogram
+{
+public:
+	static constexpr uint64_t uMaxValue = 3600ull * 1000 * 1000;	// 1 hour
+
+public:
+	LatencyHistogram() : m_vCounts(Index(uMaxValue) + 1, 0) {}
+
+	void Record(uint64_t uValue, uint64_t uCount = 1)
+	{
+		uValue = std::min(uValue, uMaxValue);
+		m_vCounts[Index(uValue)] += uCount;
+		m_uTotal += uCount;
+		m_uMin = std::min(m_uMin, uValue);
+		m_uMax = std::max(m_uMax, uValue);
+	}
+
+	// Add the requests which should have been sent while waiting for a slow response,
+	// like HdrHistogram::recordValueWithExpectedInterval()
+	void RecordCorrected(uint64_t uValue, uint64_t uExpectedInterval, uint64_t uCount = 1)
+	{
+		Record(uValue, uCount);
+		if (uExpectedInterval == 0)
+			return;
+
+		for (uint64_t uMissing = (uValue > uExpectedInterval ? uValue - uExpectedInterval : 0); uMissing >= uExpectedInterval; uMissing -= uExpectedInterval)
+			Record(uMissing, uCount);
+	}
+
+	void Add(const LatencyHistogram& rOther)
+	{
+		for (size_t i = 0; i < m_vCounts.size(); ++i)
+			m_vCounts[i] += rOther.m_vCounts[i];
+		m_uTotal += rOther.m_uTotal;
+		m_uMin = std::min(m_uMin, rOther.m_uMin);
+		m_uMax = std::max(m_uMax, rOther.m_uMax);
+	}
+
+	LatencyHistogram Corrected(uint64_t uExpectedInterval) const
+	{
+		LatencyHistogram mResult;
+		for (size_t i = 0; i < m_vCounts.size(); ++i)
+		{
+			if (m_vCounts[i] > 0)
+				mResult.RecordCorrected(HighestEquivalent(i), uExpectedInterval, m_vCounts[i]);
+		}
+		return mResult;
+	}
+
+	uint64_t ValueAtPercentile(double dPercentile) const
+	{
+		uint64_t uTarget = std::max<uint64_t>(1, (uint64_t)std::ceil(dPercentile / 100.0 * m_uTotal));
+		uint64_t uCount = 0;
+		for (size_t i = 0; i < m_vCounts.size(); ++i)
+		{
+			uCount += m_vCounts[i];
+			if (uCount >= uTarget)
+				return std::min(HighestEquivalent(i), m_uMax);
+		}
+		return m_uMax;
+	}
+
+	double Mean() const
+	{
+		if (m_uTotal == 0)
+			return 0;
+
+		double dSum = 0;
+		for (size_t i = 0; i < m_vCounts.size(); ++i)
+			dSum += (double)m_vCounts[i] * Median(i);
+		return dSum / m_uTotal;
+	}
+
+	double StdDev() const
+	{
+		if (m_uTotal == 0)
+			return 0;
+
+		double dMean = Mean(), dSum = 0;
+		for (size_t i = 0; i < m_vCounts.size(); ++i)
+			dSum += (double)m_vCounts[i] * (Median(i) - dMean) * (Median(i) - dMean);
+		return std::sqrt(dSum / m_uTotal);
+	}
+
+	uint64_t Count() const
+	{
+		return m_uTotal;
+	}
+
+	uint64_t Max() const
+	{
+		return m_uTotal > 0 ? m_uMax : 0;
+	}
+
+protected:
+	static size_t Index(uint64_t uValue)
+	{
+		if (uValue < 2048)
+			return (size_t)uValue;
+
+		unsigned int uShift = 1;
+		while ((uValue >> uShift) >= 2048)
+			++uShift;
+		return (size_t)(2048 + (uShift - 1) * 1024 + ((uValue >> uShift) - 1024));
+	}
+
+	static uint64_t LowestEquivalent(size_t uIndex)
+	{
+		if (uIndex < 2048)
+			return uIndex;
+
+		unsigned int uShift = (unsigned int)((uIndex - 2048) / 1024 + 1);
+		return (uint64_t)((uIndex - 2048) % 1024 + 1024) << uShift;
+	}
+
+	static uint64_t HighestEquivalent(size_t uIndex)
+	{
+		return LowestEquivalent(uIndex + 1) - 1;
+	}
+
+	static double Median(size_t uIndex)
+	{
+		return (LowestEquivalent(uIndex) + HighestEquivalent(uIndex)) / 2.0;
+	}
+
+protected:
+	std::vector<uint64_t>	m_vCounts;
+	uint64_t				m_uTotal = 0;
+	uint64_t				m_uMin = UINT64_MAX;
+	uint64_t				m_uMax = 0;
+};
+#pragma endregion
+
+#pragma region Load generator
+struct TLoadOptions
+{
+	size_t		m_uConnections = 10;
+	size_t		m_uIOThreads = 0;
+	bool		m_bAsync = false;	// drive the connections by the asynchronous API on I/O threads
+	double		m_dDuration = 10;	// seconds, used if m_uRequests is 0
+	uint64_t	m_uRequests = 0;
+	double		m_dRate = 0;		// requests per second, 0 means closed loop
+	std::string	m_sUnixSocket;		// connect to this Unix domain socket instead of the host of URL
+};
+
+// result of one connection
+struct TWorkerStats
+{
+	LatencyHistogram				m_hLatency;		// from the time the request should be sent
+	LatencyHistogram				m_hService;		// from the time the request is sent
+	uint64_t						m_uResponses = 0;
+	uint64_t						m_uBytes = 0;
+	std::map<std::string, uint64_t>	m_mErrors;
+};
+
+class LoadGenerator
+{
+public:
+	using TClock = std::chrono::steady_clock;
+
+public:
+	LoadGenerator(const HttpClientLite::URL& rURL, const TLoadOptions& rOptions) : m_Url(rURL), m_Options(rOptions), m_Client(MakeClientOptions(rOptions))
+	{
+		if (!m_Options.m_sUnixSocket.empty())
+			m_Client.RouteToUnixSocket(m_Url, m_Options.m_sUnixSocket);
+	}
+
+	void Run()
+	{
+		std::vector<TWorkerStats> vStats(m_Options.m_uConnections);
+		std::vector<std::thread> vThreads;
+
+		TUsage mUsageStart = Usage();
+		m_tStart = TClock::now();
+		m_tEnd = m_tStart + std::chrono::duration_cast<TClock::duration>(std::chrono::duration<double>(m_Options.m_dDuration));
+		if (m_Options.m_bAsync)
+		{
+			RunAsync(vStats);
+		}
+		else
+		{
+			for (size_t i = 0; i < m_Options.m_uConnections; ++i)
+				vThreads.emplace_back([this, &rStats = vStats[i]]() { Work(rStats); });
+			for (auto& rThread : vThreads)
+				rThread.join();
+		}
+		auto tElapsed = std::chrono::duration<double>(TClock::now() - m_tStart).count();
+		m_Usage = Usage() - mUsageStart;
+
+		TWorkerStats mTotal;
+		for (auto& rStats : vStats)
+		{
+			mTotal.m_hLatency.Add(rStats.m_hLatency);
+			mTotal.m_hService.Add(rStats.m_hService);
+			mTotal.m_uResponses += rStats.m_uResponses;
+			mTotal.m_uBytes += rStats.m_uBytes;
+			for (auto& rError : rStats.m_mErrors)
+				mTotal.m_mErrors[rError.first] += rError.second;
+		}
+		Report(mTotal, tElapsed);
+	}
+
+protected:
+	static HttpClientLite::ClientOptions MakeClientOptions(const TLoadOptions& rOptions)
+	{
+		HttpClientLite::ClientOptions mOptions;
+		mOptions.m_uIOThreads = rOptions.m_uIOThreads;
+		mOptions.m_uMaxIdlePerHost = rOptions.m_uConnections;
+		mOptions.m_uMaxIdle = std::max(mOptions.m_uMaxIdle, rOptions.m_uConnections);
+		mOptions.m_Socket.m_bNoDelay = true;
+		return mOptions;
+	}
+
+	// get the time the next request should be sent; false if the test is finished
+	bool NextRequest(TClock::time_point& tIntended)
+	{
+		uint64_t uIndex = m_uIssued++;
+		if (m_Options.m_uRequests > 0 && uIndex >= m_Options.m_uRequests)
+			return false;
+
+		if (m_Options.m_dRate > 0)
+			tIntended = m_tStart + std::chrono::duration_cast<TClock::duration>(std::chrono::duration<double>(uIndex / m_Options.m_dRate));
+		else
+			tIntended = TClock::now();
+
+		return m_Options.m_uRequests > 0 || tIntended < m_tEnd;
+	}
+
+	void Work(TWorkerStats& rStats)
+	{
+		std::shared_ptr<HttpClientLite::Session> pSession;
+		TClock::time_point tIntended;
+		while (NextRequest(tIntended))
+		{
+			std::this_thread::sleep_until(tIntended);
+			auto tSend = TClock::now();
+			if (Fetch(pSession, rStats))
+				RecordLatency(rStats, tIntended, tSend);
+		}
+
+		if (pSession)
+			m_Client.Release(pSession);
+	}
+
+	// send one request on the connection of the worker, reconnect if needed
+	bool Fetch(std::shared_ptr<HttpClientLite::Session>& pSession, TWorkerStats& rStats)
+	{
+		// errors are counted by the phase and the reason, e.g. "connect: Connection refused"
+		if (!pSession)
+		{
+			auto resSession = m_Client.TryConnect(m_Url);
+			if (!resSession)
+			{
+				++rStats.m_mErrors[resSession.error().message()];
+				return false;
+			}
+			pSession = *resSession;
+		}
+
+		auto mError = pSession->TryRequest();
+		if (mError)
+		{
+			++rStats.m_mErrors[mError.message()];
+			pSession.reset();
+			return false;
+		}
+
+		auto res = pSession->TryRead();
+		if (!res)
+		{
+			++rStats.m_mErrors[res.error().message()];
+			pSession.reset();
+			return false;
+		}
+
+		if (!CountResponse(rStats, *res))
+			pSession.reset();
+		return true;
+	}
+
+	// false if the connection can't be used again
+	static bool CountResponse(TWorkerStats& rStats, const HttpClientLite::Session::THttpResponse& rResponse)
+	{
+		++rStats.m_uResponses;
+		rStats.m_uBytes += rResponse.body().size();
+		if (rResponse.result_int() >= 400)
+			++rStats.m_mErrors["status " + std::to_string(rResponse.result_int())];
+		return rResponse.keep_alive();
+	}
+
+	static void RecordLatency(TWorkerStats& rStats, TClock::time_point tIntended, TClock::time_point tSend)
+	{
+		auto tDone = TClock::now();
+		rStats.m_hLatency.Record(std::chrono::duration_cast<std::chrono::microseconds>(tDone - tIntended).count());
+		rStats.m_hService.Record(std::chrono::duration_cast<std::chrono::microseconds>(tDone - tSend).count());
+	}
+
+	// a connection driven by the asynchronous API, each step is started by the handler of the previous one
+	struct TConnection
+	{
+		TConnection(TWorkerStats& rStats, boost::asio::io_context& ctxTimer) : m_rStats(rStats), m_Timer(ctxTimer) {}
+
+		TWorkerStats&								m_rStats;
+		std::shared_ptr<HttpClientLite::Session>	m_pSession;
+		TClock::time_point							m_tIntended;
+		TClock::time_point							m_tSend;
+		boost::asio::steady_timer					m_Timer;
+	};
+
+	// all connections share the I/O threads of Client, and only the timers of -R have their own thread
+	void RunAsync(std::vector<TWorkerStats>& vStats)
+	{
+		boost::asio::io_context ctxTimer(1);
+		auto mGuard = boost::asio::make_work_guard(ctxTimer);
+		std::thread thTimer([&ctxTimer]() { ctxTimer.run(); });
+
+		std::vector<std::unique_ptr<TConnection>> vConnections;
+		for (auto& rStats : vStats)
+			vConnections.push_back(std::make_unique<TConnection>(rStats, ctxTimer));
+
+		m_uActive = vConnections.size();
+		for (auto& pConnection : vConnections)
+			AsyncNext(*pConnection);
+
+		{
+			std::unique_lock<std::mutex> lock(m_mtxActive);
+			m_cvActive.wait(lock, [this]() { return m_uActive == 0; });
+		}
+		mGuard.reset();
+		thTimer.join();
+	}
+
+	void AsyncNext(TConnection& rConnection)
+	{
+		if (!NextRequest(rConnection.m_tIntended))
+		{
+			if (rConnection.m_pSession)
+				m_Client.Release(std::move(rConnection.m_pSession));
+
+			std::lock_guard<std::mutex> lock(m_mtxActive);
+			if (--m_uActive == 0)
+				m_cvActive.notify_all();
+			return;
+		}
+
+		if (rConnection.m_tIntended > TClock::now())
+		{
+			rConnection.m_Timer.expires_at(rConnection.m_tIntended);
+			rConnection.m_Timer.async_wait([this, &rConnection](boost::system::error_code) { AsyncSend(rConnection); });
+			return;
+		}
+		AsyncSend(rConnection);
+	}
+
+	void AsyncSend(TConnection& rConnection)
+	{
+		rConnection.m_tSend = TClock::now();
+		if (rConnection.m_pSession)
+		{
+			AsyncFetch(rConnection);
+			return;
+		}
+
+		m_Client.AsyncConnect(m_Url, [this, &rConnection](HttpClientLite::Result<std::shared_ptr<HttpClientLite::Session>> resSession) {
+			if (!resSession)
+			{
+				AsyncFailed(rConnection, resSession.error());
+				return;
+			}
+			rConnection.m_pSession = *resSession;
+			AsyncFetch(rConnection);
+		});
+	}
+
+	void AsyncFetch(TConnection& rConnection)
+	{
+		rConnection.m_pSession->AsyncRequest([this, &rConnection](HttpClientLite::RequestError mError) {
+			if (mError)
+			{
+				AsyncFailed(rConnection, mError);
+				return;
+			}
+
+			rConnection.m_pSession->AsyncRead([this, &rConnection](HttpClientLite::Result<HttpClientLite::Session::THttpResponse> res) {
+				if (!res)
+				{
+					AsyncFailed(rConnection, res.error());
+					return;
+				}
+
+				RecordLatency(rConnection.m_rStats, rConnection.m_tIntended, rConnection.m_tSend);
+				if (!CountResponse(rConnection.m_rStats, *res))
+					rConnection.m_pSession.reset();
+				AsyncNext(rConnection);
+			});
+		});
+	}
+
+	void AsyncFailed(TConnection& rConnection, const HttpClientLite::RequestError& rError)
+	{
+		++rConnection.m_rStats.m_mErrors[rError.message()];
+		rConnection.m_pSession.reset();
+		AsyncNext(rConnection);
+	}
+
+	// CPU time and context switches of the process
+	struct TUsage
+	{
+		double		m_dUser = 0;		// seconds
+		double		m_dSystem = 0;
+		uint64_t	m_uVoluntary = 0;
+		uint64_t	m_uInvoluntary = 0;
+
+		TUsage operator-(const TUsage& rOther) const
+		{
+			return TUsage{ m_dUser - rOther.m_dUser, m_dSystem - rOther.m_dSystem, m_uVoluntary - rOther.m_uVoluntary, m_uInvoluntary - rOther.m_uInvoluntary };
+		}
+	};
+
+	static TUsage Usage()
+	{
+		TUsage mUsage;
+#ifndef _WIN32
+		rusage mRusage;
+		if (getrusage(RUSAGE_SELF, &mRusage) == 0)
+		{
+			mUsage.m_dUser = mRusage.ru_utime.tv_sec + mRusage.ru_utime.tv_usec / 1e6;
+			mUsage.m_dSystem = mRusage.ru_stime.tv_sec + mRusage.ru_stime.tv_usec / 1e6;
+			mUsage.m_uVoluntary = mRusage.ru_nvcsw;
+			mUsage.m_uInvoluntary = mRusage.ru_nivcsw;
+		}
+#endif
+		return mUsage;
+	}
+
+	void Report(const TWorkerStats& rTotal, double dElapsed) const
+	{
+		// Without a target rate, the requests of a connection are expected to be sent every mean interval,
+		// so a slow response hides the requests that were not sent (coordinated omission).
+		LatencyHistogram hLatency = rTotal.m_hLatency;
+		if (m_Options.m_dRate <= 0 && rTotal.m_uResponses > 0)
+			hLatency = rTotal.m_hLatency.Corrected((uint64_t)(dElapsed * 1e6 * m_Options.m_uConnections / rTotal.m_uResponses));
+
+		std::cout << "  Thread Stats   Avg      Stdev     Max\n";
+		std::printf("    Latency   %8s  %8s  %8s\n", FormatTime(hLatency.Mean()).c_str(), FormatTime(hLatency.StdDev()).c_str(), FormatTime((double)hLatency.Max()).c_str());
+		std::printf("    Service   %8s  %8s  %8s\n", FormatTime(rTotal.m_hService.Mean()).c_str(), FormatTime(rTotal.m_hService.StdDev()).c_str(), FormatTime((double)rTotal.m_hService.Max()).c_str());
+
+		std::cout << "  Latency Distribution (corrected for coordinated omission)\n";
+		for (double dPercentile : { 50.0, 75.0, 90.0, 99.0, 99.9, 99.99, 99.999, 100.0 })
+			std::printf("  %7.3f%%  %8s\n", dPercentile, FormatTime((double)hLatency.ValueAtPercentile(dPercentile)).c_str());
+
+		std::printf("  %llu requests in %.2fs, %s read\n", (unsigned long long)rTotal.m_uResponses, dElapsed, FormatBytes((double)rTotal.m_uBytes).c_str());
+		for (auto& rError : rTotal.m_mErrors)
+			std::printf("  Errors %s: %llu\n", rError.first.c_str(), (unsigned long long)rError.second);
+		std::printf("Requests/sec: %10.2f\n", rTotal.m_uResponses / dElapsed);
+		std::printf("Transfer/sec: %10s\n", FormatBytes(rTotal.m_uBytes / dElapsed).c_str());
+#ifndef _WIN32
+		if (rTotal.m_uResponses > 0)
+		{
+			double dRequests = (double)rTotal.m_uResponses;
+			std::printf("CPU/request:  %.2fus user, %.2fus sys, %.3f context switches (%.3f involuntary)\n", m_Usage.m_dUser * 1e6 / dRequests, m_Usage.m_dSystem * 1e6 / dRequests,
+				(m_Usage.m_uVoluntary + m_Usage.m_uInvoluntary) / dRequests, m_Usage.m_uInvoluntary / dRequests);
+		}
+#endif
+	}
+
+	static std::string FormatTime(double dMicroseconds)
+	{
+		char sBuffer[32];
+		if (dMicroseconds < 1000)
+			std::snprintf(sBuffer, sizeof(sBuffer), "%.2fus", dMicroseconds);
+		else if (dMicroseconds < 1000 * 1000)
+			std::snprintf(sBuffer, sizeof(sBuffer), "%.2fms", dMicroseconds / 1000);
+		else
+			std::snprintf(sBuffer, sizeof(sBuffer), "%.2fs", dMicroseconds / 1000 / 1000);
+		return sBuffer;
+	}
+
+	static std::string FormatBytes(double dBytes)
+	{
+		const char* aUnits[] = { "B", "KB", "MB", "GB", "TB" };
+		size_t uUnit = 0;
+		while (dBytes >= 1024 && uUnit < 4)
+		{
+			dBytes /= 1024;
+			++uUnit;
+		}
+
+		char sBuffer[32];
+		std::snprintf(sBuffer, sizeof(sBuffer), "%.2f%s", dBytes, aUnits[uUnit]);
+		return sBuffer;
+	}
+
+protected:
+	HttpClientLite::URL		m_Url;
+	TLoadOptions			m_Options;
+	HttpClientLite::Client	m_Client;
+	TClock::time_point		m_tStart;
+	TClock::time_point		m_tEnd;
+	std::atomic<uint64_t>	m_uIssued{ 0 };
+	TUsage					m_Usage;
+
+	std::mutex				m_mtxActive;
+	std::condition_variable	m_cvActive;
+	size_t					m_uActive = 0;
+};
+#pragma endregion
+
+// the original behavior: read the URL once and print the body
+int FetchOnce(const HttpClientLite::URL& mUrl, const std::string& sUnixSocket)
+{
+	std::cout << "Try to open <" << mUrl.toString() << std::endl;
+
+	HttpClientLite::Client	mClient;
+	mClient.m_sigErrorLog.connect([](const std::string& sError) {
+		std::cout << "[Error] " << sError << std::endl;
+	});
+	if (!sUnixSocket.empty())
+		mClient.RouteToUnixSocket(mUrl, sUnixSocket);
+
+	auto res = mClient.Fetch(mUrl);
+	if (!res)
+	{
+		std::cout << "[Error] " << res.error().message() << std::endl;
+		return -1;
+	}
+
+	auto sBody = HttpClientLite::Session::GetBody(**res);
+	if (sBody)
+		std::wcout << *sBody << std::endl;
+
+	//std::optional<std::wstring> bHtml = mClient.ReadHtml(argv[1]);
+	//if (bHtml)
+	//{
+	//	std::wcout << bHtml.value();
+	//}
+	//else
+	//{
+	//	std::cout << "Error" << std::endl;
+	//}
+	return 0;
+}
+
+// "30", "30s", "5m" or "1h"
+double ParseDuration(const std::string& sValue)
+{
+	size_t uEnd = 0;
+	double dValue = std::stod(sValue, &uEnd);
+	std::string sUnit = sValue.substr(uEnd);
+	if (sUnit == "m")
+		return dValue * 60;
+	if (sUnit == "h")
+		return dValue * 3600;
+	if (sUnit.empty() || sUnit == "s")
+		return dValue;
+	throw std::invalid_argument("unknown unit of duration");
+}
+
+void PrintUsage()
+{
+	std::cerr << "Usage: example [options] <URL>\n"
+		"  Read the URL once if no option is given, or generate load like wrk.\n"
+		"  -c <N>         connections (default 10)\n"
+		"  -d <time>      duration, like 30s or 5m (default 10s)\n"
+		"  -n <N>         total requests, instead of duration\n"
+		"  -R <rate>      requests per second in total (open loop); send as fast as possible if not given\n"
+		"  -t <N>         I/O threads of Client\n"
+		"  --async        drive all connections with the asynchronous API on the I/O threads,\n"
+		"                 instead of one blocking thread per connection\n"
+		"  --unix <path>  connect to a Unix domain socket instead of the host of the http URL\n";
+}
+
 int main(int argc, char** argv )
 {
 	if (argc < 2)
 	{
 		std::cerr << "Please give a web URL" << std::endl;
+		PrintUsage();
 		return -1;
 	}
 
-	HttpClientLite::URL mUrl(argv[1]);
-	if (mUrl)
+	TLoadOptions mOptions;
+	bool bLoadTest = false;
+	std::string sURL;
+	try
 	{
-		std::cout << "Try to open <" << mUrl.toString() << std::endl;
+		for (int i = 1; i < argc; ++i)
+		{
+			std::string sArg = argv[i];
+			if (sArg == "--async")
+			{
+				mOptions.m_bAsync = true;
+				bLoadTest = true;
+				continue;
+			}
+			if (sArg == "--unix")
+			{
+				if (i + 1 >= argc)
+					throw std::invalid_argument("missing value of " + sArg);
 
-		HttpClientLite::Client	mClient;
-		mClient.m_sigErrorLog.connect([](const std::string& sError) {
-			std::cout << "[Error] " << sError << std::endl;
-		});
+				mOptions.m_sUnixSocket = argv[++i];
+				continue;
+			}
+			if (sArg.size() == 2 && sArg[0] == '-')
+			{
+				if (i + 1 >= argc)
+					throw std::invalid_argument("missing value of " + sArg);
+
+				std::string sValue = argv[++i];
+				switch (sArg[1])
+				{
+				case 'c':
+					mOptions.m_uConnections = std::stoul(sValue);
+					break;
+				case 'd':
+					mOptions.m_dDuration = ParseDuration(sValue);
+					break;
+				case 'n':
+					mOptions.m_uRequests = std::stoull(sValue);
+					break;
+				case 'R':
+					mOptions.m_dRate = std::stod(sValue);
+					break;
+				case 't':
+					mOptions.m_uIOThreads = std::stoul(sValue);
+					break;
+				default:
+					throw std::invalid_argument("unknown option " + sArg);
+				}
+				bLoadTest = true;
+				continue;
+			}
+			sURL = sArg;
+		}
+	}
+	catch (std::exception& e)
+	{
+		std::cerr << e.what() << std::endl;
+		PrintUsage();
+		return -1;
+	}
 
-		auto pSession = mClient.Connect(mUrl);
-		pSession->Request();
-		auto res = pSession->Read();
-		std::wcout << pSession->GetBody(res).value() << std::endl;
-		pSession->Close();
-
-		//std::optional<std::wstring> bHtml = mClient.ReadHtml(argv[1]);
-		//if (bHtml)
-		//{
-		//	std::wcout << bHtml.value();
-		//}
-		//else
-		//{
-		//	std::cout << "Error" << std::endl;
-		//}
+	HttpClientLite::URL mUrl(sURL);
+	if (!mUrl)
+	{
+		std::cerr << "Invalid URL <" << sURL << ">" << std::endl;
+		return -1;
 	}
+
+	if (!bLoadTest)
+		return FetchOnce(mUrl, mOptions.m_sUnixSocket);
+
+	if (mOptions.m_uConnections == 0)
+		mOptions.m_uConnections = 1;
+
+	if (mOptions.m_uRequests > 0)
+		std::cout << "Running " << mOptions.m_uRequests << " requests test @ " << mUrl.toString() << "\n";
+	else
+		std::cout << "Running " << mOptions.m_dDuration << "s test @ " << mUrl.toString() << "\n";
+	if (!mOptions.m_sUnixSocket.empty())
+		std::cout << "  through Unix domain socket " << mOptions.m_sUnixSocket << "\n";
+	std::cout << "  " << mOptions.m_uConnections << " connections, ";
+	if (mOptions.m_dRate > 0)
+		std::cout << "open loop at " << mOptions.m_dRate << " requests/sec\n";
+	else
+		std::cout << "closed loop\n";
+
+	LoadGenerator mGenerator(mUrl, mOptions);
+	mGenerator.Run();
+	return 0;
 }
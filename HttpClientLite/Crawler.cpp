@@ -0,0 +1,513 @@
+// STL Header
+#include <algorithm>
+#include <cmath>
+#include <atomic>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <random>
+
+// Boost Header
+#include <boost/algorithm/string.hpp>
+#include <boost/locale.hpp>
+
+// Application Header
+#include "Crawler.h"
+
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+using namespace HttpClientLite;
+
+#pragma region internal code
+static uint64_t mix64(uint64_t x)
+{
+	// finalizer of splitmix64
+	x ^= x >> 30;
+	x *= 0xbf58476d1ce4e5b9ULL;
+	x ^= x >> 27;
+	x *= 0x94d049bb133111ebULL;
+	x ^= x >> 31;
+	return x;
+}
+
+static uint64_t fnv1a64(const std::string& sData)
+{
+	// stable between runs and platforms, so the saved checkpoint can be used
+	uint64_t uHash = 0xcbf29ce484222325ULL;
+	for (unsigned char c : sData)
+	{
+		uHash ^= c;
+		uHash *= 0x100000001b3ULL;
+	}
+	return uHash;
+}
+
+template<typename T>
+static void writeValue(std::ostream& rStream, const T& rValue)
+{
+	rStream.write(reinterpret_cast<const char*>(&rValue), sizeof(T));
+}
+
+template<typename T>
+static bool readValue(std::istream& rStream, T& rValue)
+{
+	return (bool)rStream.read(reinterpret_cast<char*>(&rValue), sizeof(T));
+}
+
+static void writeString(std::ostream& rStream, const std::string& sValue)
+{
+	writeValue(rStream, (uint32_t)sValue.size());
+	rStream.write(sValue.data(), sValue.size());
+}
+
+static bool readString(std::istream& rStream, std::string& sValue)
+{
+	uint32_t uSize = 0;
+	if (!readValue(rStream, uSize))
+		return false;
+
+	sValue.resize(uSize);
+	return (bool)rStream.read(&sValue[0], uSize);
+}
+
+// "<file>.<pid>-<random>.tmp" in the same directory, so the checkpoint can be replaced by rename
+static std::filesystem::path uniqueTempPath(const std::filesystem::path& pathFile)
+{
+	static std::atomic<uint32_t> uCounter{ std::random_device()() };
+#ifdef _WIN32
+	int iProcess = _getpid();
+#else
+	int iProcess = (int)getpid();
+#endif
+	std::filesystem::path pathTemp = pathFile;
+	pathTemp += "." + std::to_string(iProcess) + "-" + std::to_string(uCounter++) + ".tmp";
+	return pathTemp;
+}
+
+static const char		sCheckpointMagic[4] = { 'H', 'C', 'L', 'C' };
+static const uint32_t	uCheckpointVersion = 1;
+#pragma endregion
+
+#pragma region Functions of URLFingerprintSet
+URLFingerprintSet::URLFingerprintSet(uint64_t uExpectedCount, double dFalsePositiveRate)
+{
+	if (uExpectedCount == 0)
+		uExpectedCount = 1;
+	if (dFalsePositiveRate <= 0.0 || dFalsePositiveRate >= 1.0)
+		dFalsePositiveRate = 0.001;
+
+	// m = -n * ln(p) / ln(2)^2, k = m / n * ln(2)
+	const double dLn2 = std::log(2.0);
+	double dBits = std::ceil(-(double)uExpectedCount * std::log(dFalsePositiveRate) / (dLn2 * dLn2));
+	uint64_t uBits = ((uint64_t)dBits + 63) / 64 * 64;
+	uint32_t uHashes = (uint32_t)std::max(1.0, std::round(dBits / uExpectedCount * dLn2));
+	allocate(uBits, uHashes);
+}
+
+void URLFingerprintSet::allocate(uint64_t uBits, uint32_t uHashes)
+{
+	m_uBits = uBits;
+	m_uHashes = uHashes;
+	m_aWords = std::make_unique<std::atomic<uint64_t>[]>(uBits / 64);
+	for (uint64_t i = 0; i < uBits / 64; ++i)
+		m_aWords[i].store(0, std::memory_order_relaxed);
+}
+
+bool URLFingerprintSet::insert(const std::string& sURL)
+{
+	// double hashing: h(i) = h1 + i * h2
+	uint64_t uHash1 = mix64(fnv1a64(sURL));
+	uint64_t uHash2 = mix64(uHash1) | 1;
+
+	bool bNew = false;
+	for (uint32_t i = 0; i < m_uHashes; ++i)
+	{
+		uint64_t uBit = (uHash1 + i * uHash2) % m_uBits;
+		uint64_t uMask = 1ULL << (uBit % 64);
+		if ((m_aWords[uBit / 64].fetch_or(uMask, std::memory_order_relaxed) & uMask) == 0)
+			bNew = true;
+	}
+	return bNew;
+}
+
+bool URLFingerprintSet::contains(const std::string& sURL) const
+{
+	uint64_t uHash1 = mix64(fnv1a64(sURL));
+	uint64_t uHash2 = mix64(uHash1) | 1;
+
+	for (uint32_t i = 0; i < m_uHashes; ++i)
+	{
+		uint64_t uBit = (uHash1 + i * uHash2) % m_uBits;
+		if ((m_aWords[uBit / 64].load(std::memory_order_relaxed) & (1ULL << (uBit % 64))) == 0)
+			return false;
+	}
+	return true;
+}
+
+bool URLFingerprintSet::save(std::ostream& rStream) const
+{
+	writeValue(rStream, m_uBits);
+	writeValue(rStream, m_uHashes);
+	for (uint64_t i = 0; i < m_uBits / 64; ++i)
+		writeValue(rStream, m_aWords[i].load(std::memory_order_relaxed));
+	return (bool)rStream;
+}
+
+bool URLFingerprintSet::load(std::istream& rStream)
+{
+	uint64_t uBits = 0;
+	uint32_t uHashes = 0;
+	if (!readValue(rStream, uBits) || !readValue(rStream, uHashes) || uBits == 0 || uBits % 64 != 0)
+		return false;
+
+	allocate(uBits, uHashes);
+	for (uint64_t i = 0; i < m_uBits / 64; ++i)
+	{
+		uint64_t uWord = 0;
+		if (!readValue(rStream, uWord))
+			return false;
+		m_aWords[i].store(uWord, std::memory_order_relaxed);
+	}
+	return true;
+}
+#pragma endregion
+
+#pragma region Functions of Crawler
+Crawler::Crawler(const CrawlOptions& rOptions) : m_Options(rOptions), m_setSeen(rOptions.m_uExpectedURLs, rOptions.m_dFalsePositiveRate)
+{
+	m_Client.m_sigErrorLog.connect([this](const std::string& sError) { m_sigErrorLog(sError); });
+
+	if (m_Options.m_uFetchThreads == 0)
+		m_Options.m_uFetchThreads = 1;
+	if (m_Options.m_uParseThreads == 0)
+		m_Options.m_uParseThreads = 1;
+}
+
+Crawler::~Crawler()
+{
+	Stop();
+	for (auto& rThread : m_vThreads)
+		if (rThread.joinable())
+			rThread.join();
+}
+
+bool Crawler::AddSeed(const URL& rURL)
+{
+	if (!rURL)
+		return false;
+
+	{
+		std::lock_guard<std::mutex> lock(m_mtxFrontier);
+		m_setScopeHosts.insert(boost::algorithm::to_lower_copy(rURL.m_sHost));
+	}
+	Enqueue(rURL, 0);
+	return true;
+}
+
+void Crawler::Run()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mtxFrontier);
+
+		// URLs which were interrupted by the last Stop()
+		for (auto it = m_mInProcess.rbegin(); it != m_mInProcess.rend(); ++it)
+			m_qFrontier.push_front(it->second);
+		m_mInProcess.clear();
+
+		// the fetch threads would wait for the page limit forever, e.g. after loading the checkpoint of a finished crawl
+		if (m_qFrontier.empty() || PageLimitReserved())
+			return;
+	}
+
+	m_bStop = false;
+	for (size_t i = 0; i < m_Options.m_uParseThreads; ++i)
+		m_vThreads.emplace_back(&Crawler::ParseLoop, this);
+	for (size_t i = 0; i < m_Options.m_uFetchThreads; ++i)
+		m_vThreads.emplace_back(&Crawler::FetchLoop, this);
+
+	for (auto& rThread : m_vThreads)
+		rThread.join();
+	m_vThreads.clear();
+
+	std::lock_guard<std::mutex> lock(m_mtxParse);
+	m_qParse.clear();
+}
+
+void Crawler::Stop()
+{
+	m_bStop = true;
+	{
+		std::lock_guard<std::mutex> lock(m_mtxFrontier);
+		m_cvFrontier.notify_all();
+	}
+	{
+		std::lock_guard<std::mutex> lock(m_mtxParse);
+		m_cvParse.notify_all();
+	}
+}
+
+bool Crawler::SaveCheckpoint(const std::string& sFilename)
+{
+	// write to a temporary file and rename it, so a crash while saving keeps the last checkpoint
+	std::filesystem::path pathFile(sFilename);
+	std::filesystem::path pathTemp = uniqueTempPath(pathFile);
+	bool bWritten = false;
+	{
+		std::ofstream fsFile(pathTemp, std::ios::binary | std::ios::trunc);
+		if (!fsFile.is_open())
+			return false;
+
+		std::lock_guard<std::mutex> lock(m_mtxFrontier);
+		fsFile.write(sCheckpointMagic, sizeof(sCheckpointMagic));
+		writeValue(fsFile, uCheckpointVersion);
+		writeValue(fsFile, m_uPageCount.load());
+
+		writeValue(fsFile, (uint64_t)m_setScopeHosts.size());
+		for (const auto& rHost : m_setScopeHosts)
+			writeString(fsFile, rHost);
+
+		// URLs in processing first, they will be crawled again after restored
+		writeValue(fsFile, (uint64_t)(m_mInProcess.size() + m_qFrontier.size()));
+		for (const auto& rItem : m_mInProcess)
+		{
+			writeValue(fsFile, rItem.second.m_uDepth);
+			writeString(fsFile, rItem.second.m_sURL);
+		}
+		for (const auto& rItem : m_qFrontier)
+		{
+			writeValue(fsFile, rItem.m_uDepth);
+			writeString(fsFile, rItem.m_sURL);
+		}
+
+		m_setSeen.save(fsFile);
+		bWritten = static_cast<bool>(fsFile.flush());
+	}
+
+	std::error_code ec;
+	if (bWritten)
+		std::filesystem::rename(pathTemp, pathFile, ec);
+	if (!bWritten || ec)
+	{
+		// don't leave the partial file
+		std::filesystem::remove(pathTemp, ec);
+		return false;
+	}
+	return true;
+}
+
+bool Crawler::LoadCheckpoint(const std::string& sFilename)
+{
+	std::ifstream fsFile(sFilename, std::ios::binary);
+	if (!fsFile.is_open())
+		return false;
+
+	char sMagic[4];
+	uint32_t uVersion = 0;
+	uint64_t uPageCount = 0, uSize = 0;
+	if (!fsFile.read(sMagic, sizeof(sMagic)) || std::memcmp(sMagic, sCheckpointMagic, sizeof(sMagic)) != 0)
+		return false;
+	if (!readValue(fsFile, uVersion) || uVersion != uCheckpointVersion || !readValue(fsFile, uPageCount))
+		return false;
+
+	std::set<std::string> setHosts;
+	if (!readValue(fsFile, uSize))
+		return false;
+	for (uint64_t i = 0; i < uSize; ++i)
+	{
+		std::string sHost;
+		if (!readString(fsFile, sHost))
+			return false;
+		setHosts.insert(sHost);
+	}
+
+	std::deque<TItem> qFrontier;
+	if (!readValue(fsFile, uSize))
+		return false;
+	for (uint64_t i = 0; i < uSize; ++i)
+	{
+		TItem mItem;
+		if (!readValue(fsFile, mItem.m_uDepth) || !readString(fsFile, mItem.m_sURL))
+			return false;
+		qFrontier.push_back(std::move(mItem));
+	}
+
+	// load() resets the set on failure, so the current one is only replaced by a complete set
+	URLFingerprintSet setSeen(1, m_Options.m_dFalsePositiveRate);
+	if (!setSeen.load(fsFile))
+		return false;
+
+	std::lock_guard<std::mutex> lock(m_mtxFrontier);
+	m_setSeen = std::move(setSeen);
+	m_uPageCount = uPageCount;
+	m_setScopeHosts = std::move(setHosts);
+	m_qFrontier = std::move(qFrontier);
+	m_mInProcess.clear();
+	return true;
+}
+
+void Crawler::FetchLoop()
+{
+	while (true)
+	{
+		uint64_t uId;
+		TItem mItem;
+		{
+			// wait if the pages in processing may reach the limit, some of them may fail
+			std::unique_lock<std::mutex> lock(m_mtxFrontier);
+			m_cvFrontier.wait(lock, [this]() { return m_bStop || (!m_qFrontier.empty() && !PageLimitReserved()); });
+			if (m_bStop)
+				return;
+
+			mItem = std::move(m_qFrontier.front());
+			m_qFrontier.pop_front();
+			uId = m_uNextId++;
+			m_mInProcess[uId] = mItem;
+		}
+
+		URL mUrl(mItem.m_sURL);
+		std::optional<std::wstring> sHtml;
+		try
+		{
+			// the page after redirections is the base of its links
+			sHtml = m_Client.ReadHtml(URL(mItem.m_sURL), m_Options.m_sDefaultCodePage, &mUrl);
+		}
+		catch (std::exception& e)
+		{
+			m_sigErrorLog("Fetch <" + mItem.m_sURL + "> failed: " + e.what());
+		}
+
+		if (sHtml && mUrl.toCanonicalString() != mItem.m_sURL && !SeeRedirected(mUrl))
+			sHtml.reset();
+
+		if (!sHtml)
+		{
+			Finish(uId);
+			continue;
+		}
+
+		std::lock_guard<std::mutex> lock(m_mtxParse);
+		m_qParse.push_back({ uId, mUrl, mItem.m_uDepth, std::move(*sHtml) });
+		m_cvParse.notify_one();
+	}
+}
+
+void Crawler::ParseLoop()
+{
+	while (true)
+	{
+		TPage mPage;
+		{
+			std::unique_lock<std::mutex> lock(m_mtxParse);
+			m_cvParse.wait(lock, [this]() { return m_bStop || !m_qParse.empty(); });
+			if (m_bStop)
+				return;
+
+			mPage = std::move(m_qParse.front());
+			m_qParse.pop_front();
+		}
+
+		++m_uPageCount;
+
+		// the page must be finished even if the handler or the parser throws, or Run() never returns
+		try
+		{
+			m_sigPage(mPage.m_Url, mPage.m_sHtml);
+
+			if (mPage.m_uDepth < m_Options.m_uMaxDepth)
+			{
+				const std::wstring& rHtml = mPage.m_sHtml;
+				for (size_t uPos = rHtml.find(L"<a "); uPos != std::wstring::npos; uPos = rHtml.find(L"<a ", uPos + 3))
+				{
+					auto pLink = HTMLParser::AnalyzeLink(rHtml, uPos);
+					if (!pLink)
+						break;
+
+					URL mLink = mPage.m_Url.resolve(boost::locale::conv::utf_to_utf<char>(pLink->second));
+					if (mLink && InScope(mLink))
+						Enqueue(mLink, mPage.m_uDepth + 1);
+				}
+			}
+		}
+		catch (std::exception& e)
+		{
+			m_sigErrorLog("Parse <" + mPage.m_Url.toString() + "> failed: " + e.what());
+		}
+
+		Finish(mPage.m_uId);
+	}
+}
+
+bool Crawler::InScope(const URL& rURL) const
+{
+	if (rURL.m_sProtocol != "http" && rURL.m_sProtocol != "https")
+		return false;
+
+	if (m_Options.m_eScope == CrawlOptions::EScope::Any)
+		return true;
+
+	// m_setScopeHosts is only modified before Run()
+	std::string sHost = boost::algorithm::to_lower_copy(rURL.m_sHost);
+	if (m_setScopeHosts.find(sHost) != m_setScopeHosts.end())
+		return true;
+
+	if (m_Options.m_eScope == CrawlOptions::EScope::SameDomain)
+	{
+		for (const auto& rHost : m_setScopeHosts)
+			if (boost::algorithm::ends_with(sHost, "." + rHost))
+				return true;
+	}
+	return false;
+}
+
+void Crawler::Enqueue(const URL& rURL, uint32_t uDepth)
+{
+	std::string sURL = rURL.toCanonicalString();
+
+	// under the lock, so a checkpoint never has the URL as seen without it in the frontier
+	std::lock_guard<std::mutex> lock(m_mtxFrontier);
+	if (!m_setSeen.insert(sURL))
+		return;
+
+	m_qFrontier.push_back({ sURL, uDepth });
+	m_cvFrontier.notify_one();
+}
+
+bool Crawler::SeeRedirected(const URL& rURL)
+{
+	// the target is crawled only once, and the redirection may leave the scope
+	if (!InScope(rURL))
+		return false;
+
+	std::lock_guard<std::mutex> lock(m_mtxFrontier);
+	return m_setSeen.insert(rURL.toCanonicalString());
+}
+
+bool Crawler::PageLimitReserved() const
+{
+	return m_Options.m_uMaxPages > 0 && m_uPageCount + m_mInProcess.size() >= m_Options.m_uMaxPages;
+}
+
+void Crawler::Finish(uint64_t uId)
+{
+	bool bDone = false;
+	{
+		std::lock_guard<std::mutex> lock(m_mtxFrontier);
+		m_mInProcess.erase(uId);
+		bool bLimit = m_Options.m_uMaxPages > 0 && m_uPageCount >= m_Options.m_uMaxPages;
+		bDone = (bLimit || m_qFrontier.empty()) && m_mInProcess.empty();
+
+		// a fetch may be waiting for the page limit
+		m_cvFrontier.notify_one();
+	}
+
+	if (bDone)
+	{
+		m_sigInfoLog("Crawl finished, " + std::to_string(m_uPageCount.load()) + " pages");
+		Stop();
+	}
+}
+#pragma endregion
@@ -0,0 +1,153 @@
+#pragma once
+
+// STL Header
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Boost Header
+#include <boost/signals2.hpp>
+
+#include "HttpClient.h"
+
+namespace HttpClientLite
+{
+	/**
+	 * Bloom filter of URL fingerprints, used as the seen-URL set of the crawler.
+	 * It is thread-safe and the size is fixed when constructed, about 1.8 bytes per URL for 0.1% false positive.
+	 */
+	class URLFingerprintSet
+	{
+	public:
+		URLFingerprintSet(uint64_t uExpectedCount, double dFalsePositiveRate);
+
+		// return true if the URL is not in the set before
+		bool insert(const std::string& sURL);
+		bool contains(const std::string& sURL) const;
+
+		uint64_t bitCount() const
+		{
+			return m_uBits;
+		}
+
+		bool save(std::ostream& rStream) const;
+		bool load(std::istream& rStream);
+
+	protected:
+		void allocate(uint64_t uBits, uint32_t uHashes);
+
+	protected:
+		uint64_t									m_uBits = 0;
+		uint32_t									m_uHashes = 0;
+		std::unique_ptr<std::atomic<uint64_t>[]>	m_aWords;
+	};
+
+	class CrawlOptions
+	{
+	public:
+		enum class EScope
+		{
+			Any,		// follow all links
+			SameHost,	// only the hosts of seeds
+			SameDomain	// the hosts of seeds and their sub-domains
+		};
+
+	public:
+		size_t		m_uFetchThreads = 4;
+		size_t		m_uParseThreads = 2;
+		uint32_t	m_uMaxDepth = 3;
+		uint64_t	m_uMaxPages = 0;		// 0 means no limit
+		EScope		m_eScope = EScope::SameHost;
+		uint64_t	m_uExpectedURLs = 10000000;
+		double		m_dFalsePositiveRate = 0.001;
+		std::string	m_sDefaultCodePage = "us-ascii";
+	};
+
+	/**
+	 * Multi-threaded crawler: fetch threads download pages with Client::ReadHtml,
+	 * parse threads extract links with HTMLParser::AnalyzeLink and push new URLs back to the frontier.
+	 */
+	class Crawler
+	{
+	public:
+		boost::signals2::signal<void(const URL&, const std::wstring&)>	m_sigPage;
+		boost::signals2::signal<void(const std::string&)>				m_sigErrorLog;
+		boost::signals2::signal<void(const std::string&)>				m_sigInfoLog;
+
+	public:
+		Crawler(const CrawlOptions& rOptions = CrawlOptions());
+		~Crawler();
+
+		bool AddSeed(const URL& rURL);
+
+		// block until there is no URL to crawl, the page limit is reached or Stop() is called
+		// At the limit, the pages in processing are finished, so m_sigPage is called m_uMaxPages times.
+		void Run();
+		void Stop();
+
+		// the frontier, URLs in processing and the seen-URL set are saved, so Run() can continue after LoadCheckpoint()
+		bool SaveCheckpoint(const std::string& sFilename);
+		bool LoadCheckpoint(const std::string& sFilename);
+
+		// pages delivered by m_sigPage
+		uint64_t PageCount() const
+		{
+			return m_uPageCount;
+		}
+
+	protected:
+		struct TItem
+		{
+			std::string	m_sURL;
+			uint32_t	m_uDepth;
+		};
+
+		struct TPage
+		{
+			uint64_t		m_uId;
+			URL				m_Url;
+			uint32_t		m_uDepth;
+			std::wstring	m_sHtml;
+		};
+
+		void FetchLoop();
+		void ParseLoop();
+
+		bool InScope(const URL& rURL) const;
+		void Enqueue(const URL& rURL, uint32_t uDepth);
+
+		// mark the target of a redirection as seen; false if it is out of scope or already seen
+		bool SeeRedirected(const URL& rURL);
+		void Finish(uint64_t uId);
+
+		// the delivered pages and the pages in processing reach m_uMaxPages; m_mtxFrontier should be locked
+		bool PageLimitReserved() const;
+
+	protected:
+		CrawlOptions				m_Options;
+		Client						m_Client;
+		URLFingerprintSet			m_setSeen;
+		std::set<std::string>		m_setScopeHosts;
+
+		std::mutex					m_mtxFrontier;
+		std::condition_variable		m_cvFrontier;
+		std::deque<TItem>			m_qFrontier;
+		std::map<uint64_t, TItem>	m_mInProcess;
+		uint64_t					m_uNextId = 0;
+
+		std::mutex					m_mtxParse;
+		std::condition_variable		m_cvParse;
+		std::deque<TPage>			m_qParse;
+
+		std::atomic<bool>			m_bStop{ false };
+		std::atomic<uint64_t>		m_uPageCount{ 0 };
+		std::vector<std::thread>	m_vThreads;
+	};
+}
@@ -0,0 +1,567 @@
+// STL Header
+#include <algorithm>
+#include <cwctype>
+
+// Application Header
+#include "DocumentIndex.h"
+
+using namespace HttpClientLite;
+
+#pragma region internal code
+static bool isNameChar(wchar_t c)
+{
+	return std::iswalnum(c) || c == L'-' || c == L'_' || c == L':' || c == L'.';
+}
+
+static bool isSpace(wchar_t c)
+{
+	return c == L' ' || c == L'\t' || c == L'\r' || c == L'\n' || c == L'\f';
+}
+
+static std::wstring toLower(std::wstring_view sInput)
+{
+	std::wstring sOutput(sInput);
+	for (auto& c : sOutput)
+		c = std::towlower(c);
+	return sOutput;
+}
+
+// elements which never have end tag
+static bool isVoidElement(const std::wstring& sName)
+{
+	static const wchar_t* aNames[] = { L"area", L"base", L"br", L"col", L"embed", L"hr", L"img", L"input", L"link", L"meta", L"param", L"source", L"track", L"wbr" };
+	for (auto sVoid : aNames)
+		if (sName == sVoid)
+			return true;
+	return false;
+}
+
+// elements which content is not HTML
+static bool isRawTextElement(const std::wstring& sName)
+{
+	return sName == L"script" || sName == L"style" || sName == L"textarea" || sName == L"title";
+}
+
+static size_t findNoCase(std::wstring_view sSource, const std::wstring& sTarget, size_t uPos)
+{
+	auto it = std::search(sSource.begin() + std::min(uPos, sSource.size()), sSource.end(), sTarget.begin(), sTarget.end(),
+		[](wchar_t c1, wchar_t c2) { return (wint_t)std::towlower(c1) == (wint_t)c2; });
+	return it == sSource.end() ? std::wstring_view::npos : (size_t)(it - sSource.begin());
+}
+
+static uint32_t internName(const std::wstring& sName, std::vector<std::wstring>& vNames, std::unordered_map<std::wstring, uint32_t>& mIds, std::vector< std::vector<uint32_t> >& vPostings)
+{
+	auto itId = mIds.find(sName);
+	if (itId != mIds.end())
+		return itId->second;
+
+	uint32_t uId = (uint32_t)vNames.size();
+	vNames.push_back(sName);
+	vPostings.emplace_back();
+	mIds.emplace(sName, uId);
+	return uId;
+}
+#pragma endregion
+
+DocumentIndex::DocumentIndex(std::wstring_view sHtml) : m_sHtml(sHtml)
+{
+	m_vAttrOffset.push_back(0);
+	Build();
+}
+
+void DocumentIndex::Build()
+{
+	std::vector<uint32_t> vStack;
+
+	size_t uPos = 0;
+	while ((uPos = m_sHtml.find(L'<', uPos)) != std::wstring_view::npos)
+	{
+		std::wstring_view sRest = m_sHtml.substr(uPos);
+		if (sRest.compare(0, 4, L"<!--") == 0)
+		{
+			// comment
+			uPos = m_sHtml.find(L"-->", uPos + 4);
+			if (uPos == std::wstring_view::npos)
+				break;
+			uPos += 3;
+		}
+		else if (sRest.size() > 1 && (sRest[1] == L'!' || sRest[1] == L'?'))
+		{
+			// <!DOCTYPE>, <?xml?>
+			uPos = m_sHtml.find(L'>', uPos);
+			if (uPos == std::wstring_view::npos)
+				break;
+			++uPos;
+		}
+		else if (sRest.size() > 2 && sRest[1] == L'/' && std::iswalpha(sRest[2]))
+		{
+			uPos = ParseEndTag(uPos, vStack);
+		}
+		else if (sRest.size() > 1 && std::iswalpha(sRest[1]))
+		{
+			uPos = ParseStartTag(uPos, vStack);
+		}
+		else
+		{
+			++uPos;
+		}
+	}
+
+	// tags which are not closed end at the end of document
+	while (!vStack.empty())
+	{
+		CloseTag(vStack.back(), m_sHtml.size(), m_sHtml.size());
+		vStack.pop_back();
+	}
+}
+
+size_t DocumentIndex::ParseStartTag(size_t uPos, std::vector<uint32_t>& vStack)
+{
+	const size_t uSize = m_sHtml.size();
+	const uint32_t uTag = (uint32_t)m_vNameId.size();
+
+	// tag name
+	size_t uNameEnd = uPos + 1;
+	while (uNameEnd < uSize && isNameChar(m_sHtml[uNameEnd]))
+		++uNameEnd;
+	std::wstring sName = toLower(m_sHtml.substr(uPos + 1, uNameEnd - uPos - 1));
+	uint32_t uNameId = internName(sName, m_vTagNames, m_mTagNameId, m_vTagsByName);
+
+	// attributes
+	bool bSelfClosed = false;
+	size_t uCur = uNameEnd;
+	while (uCur < uSize && m_sHtml[uCur] != L'>')
+	{
+		wchar_t c = m_sHtml[uCur];
+		if (isSpace(c))
+		{
+			++uCur;
+			continue;
+		}
+		if (c == L'/')
+		{
+			bSelfClosed = (uCur + 1 < uSize && m_sHtml[uCur + 1] == L'>');
+			++uCur;
+			continue;
+		}
+
+		size_t uAttrBegin = uCur;
+		while (uCur < uSize && !isSpace(m_sHtml[uCur]) && m_sHtml[uCur] != L'=' && m_sHtml[uCur] != L'>' && m_sHtml[uCur] != L'/')
+			++uCur;
+		std::wstring sAttrName = toLower(m_sHtml.substr(uAttrBegin, uCur - uAttrBegin));
+
+		while (uCur < uSize && isSpace(m_sHtml[uCur]))
+			++uCur;
+
+		uint32_t uValueBegin = npos, uValueLength = 0;
+		if (uCur < uSize && m_sHtml[uCur] == L'=')
+		{
+			++uCur;
+			while (uCur < uSize && isSpace(m_sHtml[uCur]))
+				++uCur;
+
+			if (uCur < uSize && (m_sHtml[uCur] == L'"' || m_sHtml[uCur] == L'\''))
+			{
+				size_t uEnd = m_sHtml.find(m_sHtml[uCur], uCur + 1);
+				if (uEnd == std::wstring_view::npos)
+					uEnd = uSize;
+				uValueBegin = (uint32_t)(uCur + 1);
+				uValueLength = (uint32_t)(uEnd - uCur - 1);
+				uCur = std::min(uEnd + 1, uSize);
+			}
+			else
+			{
+				size_t uEnd = uCur;
+				while (uEnd < uSize && !isSpace(m_sHtml[uEnd]) && m_sHtml[uEnd] != L'>')
+					++uEnd;
+				uValueBegin = (uint32_t)uCur;
+				uValueLength = (uint32_t)(uEnd - uCur);
+				uCur = uEnd;
+			}
+		}
+
+		if (sAttrName.empty())
+			continue;
+
+		uint32_t uAttrId = internName(sAttrName, m_vAttrNames, m_mAttrNameId, m_vTagsByAttr);
+		m_vAttrNameId.push_back(uAttrId);
+		m_vAttrValueBegin.push_back(uValueBegin);
+		m_vAttrValueLength.push_back(uValueLength);
+
+		if (m_vTagsByAttr[uAttrId].empty() || m_vTagsByAttr[uAttrId].back() != uTag)
+			m_vTagsByAttr[uAttrId].push_back(uTag);
+
+		if (uValueBegin != npos)
+		{
+			std::wstring_view sValue = m_sHtml.substr(uValueBegin, uValueLength);
+			if (sAttrName == L"id")
+			{
+				m_mTagsById[std::wstring(sValue)].push_back(uTag);
+			}
+			else
+			{
+				auto& vTags = m_mTagsByAttrValue[AttributeValueKey(uAttrId, sValue)];
+				if (vTags.empty() || vTags.back() != uTag)
+					vTags.push_back(uTag);
+			}
+
+			if (sAttrName == L"class")
+			{
+				size_t uBegin = 0;
+				while (uBegin < sValue.size())
+				{
+					while (uBegin < sValue.size() && isSpace(sValue[uBegin]))
+						++uBegin;
+					size_t uEnd = uBegin;
+					while (uEnd < sValue.size() && !isSpace(sValue[uEnd]))
+						++uEnd;
+					if (uEnd > uBegin)
+					{
+						auto& vTags = m_mTagsByClass[std::wstring(sValue.substr(uBegin, uEnd - uBegin))];
+						if (vTags.empty() || vTags.back() != uTag)
+							vTags.push_back(uTag);
+					}
+					uBegin = uEnd;
+				}
+			}
+		}
+	}
+	size_t uOpenEnd = std::min(uCur + 1, uSize);
+
+	m_vNameId.push_back(uNameId);
+	m_vOpenBegin.push_back((uint32_t)uPos);
+	m_vOpenEnd.push_back((uint32_t)uOpenEnd);
+	m_vCloseBegin.push_back((uint32_t)uOpenEnd);
+	m_vCloseEnd.push_back((uint32_t)uOpenEnd);
+	m_vParent.push_back(vStack.empty() ? npos : vStack.back());
+	m_vDepth.push_back((uint32_t)vStack.size());
+	m_vAttrOffset.push_back((uint32_t)m_vAttrNameId.size());
+	m_vTagsByName[uNameId].push_back(uTag);
+
+	if (bSelfClosed || isVoidElement(sName))
+		return uOpenEnd;
+
+	if (isRawTextElement(sName))
+	{
+		// don't parse the content of <script> or <style>
+		size_t uClose = findNoCase(m_sHtml, L"</" + sName, uOpenEnd);
+		if (uClose == std::wstring_view::npos)
+		{
+			CloseTag(uTag, uSize, uSize);
+			return uSize;
+		}
+
+		size_t uCloseEnd = m_sHtml.find(L'>', uClose);
+		uCloseEnd = (uCloseEnd == std::wstring_view::npos) ? uSize : uCloseEnd + 1;
+		CloseTag(uTag, uClose, uCloseEnd);
+		return uCloseEnd;
+	}
+
+	vStack.push_back(uTag);
+	return uOpenEnd;
+}
+
+size_t DocumentIndex::ParseEndTag(size_t uPos, std::vector<uint32_t>& vStack)
+{
+	size_t uNameEnd = uPos + 2;
+	while (uNameEnd < m_sHtml.size() && isNameChar(m_sHtml[uNameEnd]))
+		++uNameEnd;
+
+	size_t uCloseEnd = m_sHtml.find(L'>', uNameEnd);
+	uCloseEnd = (uCloseEnd == std::wstring_view::npos) ? m_sHtml.size() : uCloseEnd + 1;
+
+	auto itId = m_mTagNameId.find(toLower(m_sHtml.substr(uPos + 2, uNameEnd - uPos - 2)));
+	if (itId == m_mTagNameId.end())
+		return uCloseEnd;
+
+	// find the matched start tag; tags opened after it are closed implicitly (like <p> or <li>)
+	auto itTag = std::find_if(vStack.rbegin(), vStack.rend(), [this, &itId](uint32_t uTag) { return m_vNameId[uTag] == itId->second; });
+	if (itTag == vStack.rend())
+		return uCloseEnd;
+
+	while (vStack.back() != *itTag)
+	{
+		CloseTag(vStack.back(), uPos, uPos);
+		vStack.pop_back();
+	}
+	CloseTag(vStack.back(), uPos, uCloseEnd);
+	vStack.pop_back();
+	return uCloseEnd;
+}
+
+void DocumentIndex::CloseTag(uint32_t uTag, size_t uCloseBegin, size_t uCloseEnd)
+{
+	m_vCloseBegin[uTag] = (uint32_t)uCloseBegin;
+	m_vCloseEnd[uTag] = (uint32_t)uCloseEnd;
+}
+
+uint32_t DocumentIndex::GetAttributeId(const std::wstring& sName) const
+{
+	auto itId = m_mAttrNameId.find(toLower(sName));
+	return itId == m_mAttrNameId.end() ? npos : itId->second;
+}
+
+size_t DocumentIndex::AttributeValueKey(uint32_t uAttrId, std::wstring_view sValue)
+{
+	size_t uHash = std::hash<std::wstring_view>()(sValue);
+	return uHash ^ (uAttrId + 0x9e3779b9 + (uHash << 6) + (uHash >> 2));
+}
+
+const std::vector<uint32_t>* DocumentIndex::FindByAttributeValue(uint32_t uAttrId, std::wstring_view sValue) const
+{
+	auto itTags = m_mTagsByAttrValue.find(AttributeValueKey(uAttrId, sValue));
+	return itTags == m_mTagsByAttrValue.end() ? nullptr : &itTags->second;
+}
+
+std::optional<std::wstring_view> DocumentIndex::GetAttribute(uint32_t uTag, const std::wstring& sName) const
+{
+	uint32_t uAttrId = GetAttributeId(sName);
+	if (uAttrId != npos)
+	{
+		for (uint32_t i = m_vAttrOffset[uTag]; i < m_vAttrOffset[uTag + 1]; ++i)
+		{
+			if (m_vAttrNameId[i] == uAttrId)
+			{
+				if (m_vAttrValueBegin[i] == npos)
+					return std::wstring_view();
+				return m_sHtml.substr(m_vAttrValueBegin[i], m_vAttrValueLength[i]);
+			}
+		}
+	}
+	return std::nullopt;
+}
+
+std::vector<uint32_t> DocumentIndex::FindByTag(const std::wstring& sName) const
+{
+	auto itId = m_mTagNameId.find(toLower(sName));
+	if (itId == m_mTagNameId.end())
+		return std::vector<uint32_t>();
+
+	return m_vTagsByName[itId->second];
+}
+
+std::vector<uint32_t> DocumentIndex::FindByAttribute(const std::wstring& sName, const std::optional<std::wstring>& sValue) const
+{
+	std::vector<uint32_t> vResult;
+
+	std::wstring sAttrName = toLower(sName);
+	if (sValue && sAttrName == L"id")
+	{
+		auto itTags = m_mTagsById.find(*sValue);
+		if (itTags != m_mTagsById.end())
+			vResult = itTags->second;
+		return vResult;
+	}
+
+	uint32_t uAttrId = GetAttributeId(sAttrName);
+	if (uAttrId == npos)
+		return vResult;
+
+	if (!sValue)
+		return m_vTagsByAttr[uAttrId];
+
+	auto pTags = FindByAttributeValue(uAttrId, *sValue);
+	if (!pTags)
+		return vResult;
+
+	for (uint32_t uTag : *pTags)
+	{
+		auto sAttrValue = GetAttribute(uTag, sAttrName);
+		if (sAttrValue && *sAttrValue == *sValue)
+			vResult.push_back(uTag);
+	}
+	return vResult;
+}
+
+std::vector<uint32_t> DocumentIndex::Select(const std::wstring& sSelector) const
+{
+	std::vector<uint32_t> vResult;
+
+	auto vSelectors = ParseSelector(sSelector);
+	if (!vSelectors || vSelectors->empty())
+		return vResult;
+
+	// use the shortest tag list of the indexes for the last compound selector
+	const TSelector& rLast = vSelectors->back();
+	const std::vector<uint32_t>* pCandidates = nullptr;
+	bool bNoMatch = false;
+	// nullptr means no tag is in the index
+	auto funcNarrow = [&pCandidates, &bNoMatch](const std::vector<uint32_t>* pTags) {
+		if (!pTags)
+			bNoMatch = true;
+		else if (!pCandidates || pTags->size() < pCandidates->size())
+			pCandidates = pTags;
+	};
+
+	auto funcById = [this](const std::wstring& sId) {
+		auto itTags = m_mTagsById.find(sId);
+		return itTags == m_mTagsById.end() ? nullptr : &itTags->second;
+	};
+
+	if (rLast.m_sId)
+		funcNarrow(funcById(*rLast.m_sId));
+	for (const auto& rClass : rLast.m_vClasses)
+	{
+		auto itTags = m_mTagsByClass.find(rClass);
+		funcNarrow(itTags == m_mTagsByClass.end() ? nullptr : &itTags->second);
+	}
+	if (rLast.m_sTag)
+	{
+		auto itId = m_mTagNameId.find(*rLast.m_sTag);
+		funcNarrow(itId == m_mTagNameId.end() ? nullptr : &m_vTagsByName[itId->second]);
+	}
+	for (const auto& rAttribute : rLast.m_vAttributes)
+	{
+		uint32_t uAttrId = GetAttributeId(rAttribute.first);
+		if (uAttrId == npos)
+			funcNarrow(nullptr);
+		else if (!rAttribute.second)
+			funcNarrow(&m_vTagsByAttr[uAttrId]);
+		else if (rAttribute.first == L"id")
+			funcNarrow(funcById(*rAttribute.second));
+		else
+			funcNarrow(FindByAttributeValue(uAttrId, *rAttribute.second));
+	}
+	if (bNoMatch)
+		return vResult;
+
+	std::vector<uint32_t> vAll;
+	if (!pCandidates)
+	{
+		vAll.resize(size());
+		for (uint32_t i = 0; i < vAll.size(); ++i)
+			vAll[i] = i;
+		pCandidates = &vAll;
+	}
+
+	for (uint32_t uTag : *pCandidates)
+	{
+		if (Match(uTag, rLast) && (vSelectors->size() == 1 || MatchAncestor(m_vParent[uTag], *vSelectors, vSelectors->size() - 2)))
+			vResult.push_back(uTag);
+	}
+	return vResult;
+}
+
+bool DocumentIndex::HasClass(uint32_t uTag, const std::wstring& sClass) const
+{
+	auto sValue = GetAttribute(uTag, L"class");
+	if (!sValue)
+		return false;
+
+	size_t uPos = 0;
+	while ((uPos = sValue->find(sClass, uPos)) != std::wstring_view::npos)
+	{
+		size_t uEnd = uPos + sClass.size();
+		if ((uPos == 0 || isSpace((*sValue)[uPos - 1])) && (uEnd == sValue->size() || isSpace((*sValue)[uEnd])))
+			return true;
+		uPos = uEnd;
+	}
+	return false;
+}
+
+bool DocumentIndex::Match(uint32_t uTag, const TSelector& rSelector) const
+{
+	if (rSelector.m_sTag && GetName(uTag) != *rSelector.m_sTag)
+		return false;
+
+	if (rSelector.m_sId)
+	{
+		auto sId = GetAttribute(uTag, L"id");
+		if (!sId || *sId != *rSelector.m_sId)
+			return false;
+	}
+
+	for (const auto& rClass : rSelector.m_vClasses)
+		if (!HasClass(uTag, rClass))
+			return false;
+
+	for (const auto& rAttribute : rSelector.m_vAttributes)
+	{
+		auto sValue = GetAttribute(uTag, rAttribute.first);
+		if (!sValue || (rAttribute.second && *sValue != *rAttribute.second))
+			return false;
+	}
+	return true;
+}
+
+bool DocumentIndex::MatchAncestor(uint32_t uTag, const std::vector<TSelector>& vSelectors, size_t uIndex) const
+{
+	for (; uTag != npos; uTag = m_vParent[uTag])
+	{
+		if (Match(uTag, vSelectors[uIndex]) && (uIndex == 0 || MatchAncestor(m_vParent[uTag], vSelectors, uIndex - 1)))
+			return true;
+	}
+	return false;
+}
+
+std::optional< std::vector<DocumentIndex::TSelector> > DocumentIndex::ParseSelector(const std::wstring& sSelector)
+{
+	std::vector<TSelector> vSelectors;
+
+	auto funcReadName = [&sSelector](size_t& uPos) {
+		size_t uBegin = uPos;
+		while (uPos < sSelector.size() && (std::iswalnum(sSelector[uPos]) || sSelector[uPos] == L'-' || sSelector[uPos] == L'_' || sSelector[uPos] == L':'))
+			++uPos;
+		return sSelector.substr(uBegin, uPos - uBegin);
+	};
+
+	size_t uPos = 0;
+	while (uPos < sSelector.size())
+	{
+		if (isSpace(sSelector[uPos]))
+		{
+			++uPos;
+			continue;
+		}
+
+		TSelector mSelector;
+		if (sSelector[uPos] == L'*')
+		{
+			++uPos;
+		}
+		else if (std::iswalpha(sSelector[uPos]))
+		{
+			mSelector.m_sTag = toLower(funcReadName(uPos));
+		}
+
+		while (uPos < sSelector.size() && !isSpace(sSelector[uPos]))
+		{
+			wchar_t c = sSelector[uPos++];
+			if (c == L'#')
+			{
+				mSelector.m_sId = funcReadName(uPos);
+			}
+			else if (c == L'.')
+			{
+				mSelector.m_vClasses.push_back(funcReadName(uPos));
+			}
+			else if (c == L'[')
+			{
+				size_t uEnd = sSelector.find(L']', uPos);
+				if (uEnd == std::wstring::npos)
+					return std::nullopt;
+
+				std::wstring sAttribute = sSelector.substr(uPos, uEnd - uPos);
+				size_t uEqual = sAttribute.find(L'=');
+				if (uEqual == std::wstring::npos)
+				{
+					mSelector.m_vAttributes.emplace_back(toLower(sAttribute), std::nullopt);
+				}
+				else
+				{
+					std::wstring sValue = sAttribute.substr(uEqual + 1);
+					if (sValue.size() >= 2 && (sValue.front() == L'"' || sValue.front() == L'\'') && sValue.back() == sValue.front())
+						sValue = sValue.substr(1, sValue.size() - 2);
+					mSelector.m_vAttributes.emplace_back(toLower(sAttribute.substr(0, uEqual)), sValue);
+				}
+				uPos = uEnd + 1;
+			}
+			else
+			{
+				return std::nullopt;
+			}
+		}
+		vSelectors.push_back(std::move(mSelector));
+	}
+	return vSelectors;
+}
@@ -0,0 +1,130 @@
+#pragma once
+
+// STL Header
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace HttpClientLite
+{
+	/**
+	 * Index of all tags in a HTML document, built in one pass.
+	 * Name, attributes, open/close position, parent and depth of tags are saved in separated arrays,
+	 * and tags can be found by name, attribute or a simple CSS selector without scanning the document again.
+	 * Only positions are saved, so the source string must live longer than the index.
+	 */
+	class DocumentIndex
+	{
+	public:
+		static constexpr uint32_t npos = 0xFFFFFFFF;
+
+	public:
+		DocumentIndex(std::wstring_view sHtml);
+
+		size_t size() const
+		{
+			return m_vNameId.size();
+		}
+
+		// position of '<' of the start tag
+		size_t GetBegin(uint32_t uTag) const
+		{
+			return m_vOpenBegin[uTag];
+		}
+
+		uint32_t GetParent(uint32_t uTag) const
+		{
+			return m_vParent[uTag];
+		}
+
+		uint32_t GetDepth(uint32_t uTag) const
+		{
+			return m_vDepth[uTag];
+		}
+
+		// tag name in lower case
+		const std::wstring& GetName(uint32_t uTag) const
+		{
+			return m_vTagNames[m_vNameId[uTag]];
+		}
+
+		// the whole element, from the start tag to the end tag
+		std::wstring_view GetSource(uint32_t uTag) const
+		{
+			return m_sHtml.substr(m_vOpenBegin[uTag], m_vCloseEnd[uTag] - m_vOpenBegin[uTag]);
+		}
+
+		// the content between the start tag and the end tag
+		std::wstring_view GetContent(uint32_t uTag) const
+		{
+			return m_sHtml.substr(m_vOpenEnd[uTag], m_vCloseBegin[uTag] - m_vOpenEnd[uTag]);
+		}
+
+		// return an empty value for attribute without value, and std::nullopt if the attribute doesn't exist
+		std::optional<std::wstring_view> GetAttribute(uint32_t uTag, const std::wstring& sName) const;
+
+		std::vector<uint32_t> FindByTag(const std::wstring& sName) const;
+
+		// find tags which have the attribute, and the value is the same if given
+		std::vector<uint32_t> FindByAttribute(const std::wstring& sName, const std::optional<std::wstring>& sValue = std::nullopt) const;
+
+		// support "tag", "*", ".class", "#id", "[attr]", "[attr=value]", their combination, and descendant by space
+		std::vector<uint32_t> Select(const std::wstring& sSelector) const;
+
+	protected:
+		struct TSelector
+		{
+			std::optional<std::wstring>											m_sTag;
+			std::optional<std::wstring>											m_sId;
+			std::vector<std::wstring>											m_vClasses;
+			std::vector< std::pair<std::wstring, std::optional<std::wstring>> >	m_vAttributes;
+		};
+
+		void Build();
+		size_t ParseStartTag(size_t uPos, std::vector<uint32_t>& vStack);
+		size_t ParseEndTag(size_t uPos, std::vector<uint32_t>& vStack);
+		void CloseTag(uint32_t uTag, size_t uCloseBegin, size_t uCloseEnd);
+
+		uint32_t GetAttributeId(const std::wstring& sName) const;
+
+		// tags which may have the attribute value, different values can have the same hash; nullptr if none
+		const std::vector<uint32_t>* FindByAttributeValue(uint32_t uAttrId, std::wstring_view sValue) const;
+		static size_t AttributeValueKey(uint32_t uAttrId, std::wstring_view sValue);
+		bool HasClass(uint32_t uTag, const std::wstring& sClass) const;
+		bool Match(uint32_t uTag, const TSelector& rSelector) const;
+		bool MatchAncestor(uint32_t uTag, const std::vector<TSelector>& vSelectors, size_t uIndex) const;
+
+		static std::optional< std::vector<TSelector> > ParseSelector(const std::wstring& sSelector);
+
+	protected:
+		std::wstring_view			m_sHtml;
+
+		// tags
+		std::vector<uint32_t>		m_vNameId;
+		std::vector<uint32_t>		m_vOpenBegin;
+		std::vector<uint32_t>		m_vOpenEnd;
+		std::vector<uint32_t>		m_vCloseBegin;
+		std::vector<uint32_t>		m_vCloseEnd;
+		std::vector<uint32_t>		m_vParent;
+		std::vector<uint32_t>		m_vDepth;
+		std::vector<uint32_t>		m_vAttrOffset;		// attributes of tag i are [m_vAttrOffset[i], m_vAttrOffset[i+1])
+
+		// attributes
+		std::vector<uint32_t>		m_vAttrNameId;
+		std::vector<uint32_t>		m_vAttrValueBegin;	// npos if no value
+		std::vector<uint32_t>		m_vAttrValueLength;
+
+		// lookup tables, tag lists are in document order
+		std::vector<std::wstring>								m_vTagNames;
+		std::unordered_map<std::wstring, uint32_t>				m_mTagNameId;
+		std::vector< std::vector<uint32_t> >					m_vTagsByName;
+		std::vector<std::wstring>								m_vAttrNames;
+		std::unordered_map<std::wstring, uint32_t>				m_mAttrNameId;
+		std::vector< std::vector<uint32_t> >					m_vTagsByAttr;
+		std::unordered_map<std::wstring, std::vector<uint32_t>>	m_mTagsById;
+		std::unordered_map<std::wstring, std::vector<uint32_t>>	m_mTagsByClass;
+		std::unordered_map<size_t, std::vector<uint32_t>>		m_mTagsByAttrValue;	// AttributeValueKey(), except id
+	};
+}
@@ -1,8 +1,17 @@
 // STL Header
+#include <algorithm>
+#include <cctype>
 #include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
 #include <map>
 #include <vector>
+#include <filesystem>
 #include <fstream>
+#include <future>
+#include <limits>
+#include <random>
 #include <sstream>
 
 // Boost Header
@@ -11,57 +20,382 @@
 #include <boost/beast/core.hpp>
 #include <boost/beast/http.hpp>
 #include <boost/beast/version.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
 #include <boost/asio/connect.hpp>
 #include <boost/asio/ip/tcp.hpp>
 #include <boost/asio/ssl/error.hpp>
 #include <boost/asio/ssl/stream.hpp>
+#include <boost/version.hpp>
+
+#ifdef __linux__
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#endif
+
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
 
 // Application Header
 #include "HttpClient.h"
+#include "DocumentIndex.h"
 #include "root_certificates.hpp"
 
 namespace HttpClientLite
 {
-	template<typename TStreamType>
-	class TAbsSession : public Session
+	/**
+	 * Resumable TLS sessions of hosts
+	 */
+	class TLSSessionCache
 	{
 	public:
-		TAbsSession(boost::asio::io_context& ctxAsio) : m_Resolver(ctxAsio){}
+		~TLSSessionCache()
+		{
+			for (auto& rSession : m_mSessions)
+				SSL_SESSION_free(rSession.second);
+		}
 
-		virtual bool Request() override
+		// the caller owns the returned session
+		SSL_SESSION* Get(const std::string& sKey)
 		{
-			try
+			std::lock_guard<std::mutex> lock(m_mtxSessions);
+			auto itSession = m_mSessions.find(sKey);
+			if (itSession == m_mSessions.end())
+				return nullptr;
+
+			SSL_SESSION_up_ref(itSession->second);
+			return itSession->second;
+		}
+
+		// the cache owns the session
+		void Put(const std::string& sKey, SSL_SESSION* pSession)
+		{
+			std::lock_guard<std::mutex> lock(m_mtxSessions);
+			auto& rSession = m_mSessions[sKey];
+			if (rSession)
+				SSL_SESSION_free(rSession);
+			rSession = pSession;
+		}
+
+		// DER encoded sessions which are not expired
+		std::vector<std::pair<std::string, std::string>> Export()
+		{
+			std::vector<std::pair<std::string, std::string>> vSessions;
+			std::lock_guard<std::mutex> lock(m_mtxSessions);
+			int64_t iNow = (int64_t)std::time(nullptr);
+			for (auto& rSession : m_mSessions)
 			{
-				using tcp = boost::asio::ip::tcp;       // from <boost/asio/ip/tcp.hpp>
-				namespace http = boost::beast::http;    // from <boost/beast/http.hpp>
+				if (SSL_SESSION_get_time(rSession.second) + SSL_SESSION_get_timeout(rSession.second) <= iNow)
+					continue;
 
-				// Set up an HTTP GET request message
-				http::request<http::string_body> mRequest{ http::verb::get, m_Url.getTarget(), m_iHttpVersion };
-				mRequest.set(http::field::host, m_Url.m_sHost);
-				mRequest.set(http::field::user_agent, BOOST_BEAST_VERSION_STRING);
+				int iSize = i2d_SSL_SESSION(rSession.second, nullptr);
+				if (iSize <= 0)
+					continue;
 
-				// Send the HTTP request to the remote host
-				http::write(*m_tStream, mRequest);
+				std::string sData(iSize, '\0');
+				unsigned char* pData = reinterpret_cast<unsigned char*>(&sData[0]);
+				if (i2d_SSL_SESSION(rSession.second, &pData) == iSize)
+					vSessions.emplace_back(rSession.first, std::move(sData));
 			}
-			catch (std::exception e)
+			return vSessions;
+		}
+
+		bool Import(const std::string& sKey, const std::string& sData)
+		{
+			const unsigned char* pData = reinterpret_cast<const unsigned char*>(sData.data());
+			SSL_SESSION* pSession = d2i_SSL_SESSION(nullptr, &pData, (long)sData.size());
+			if (!pSession)
+				return false;
+
+			if (SSL_SESSION_get_time(pSession) + SSL_SESSION_get_timeout(pSession) <= (int64_t)std::time(nullptr))
 			{
+				SSL_SESSION_free(pSession);
 				return false;
 			}
-
+			Put(sKey, pSession);
 			return true;
 		}
 
-		virtual THttpResponse Read() override
+	protected:
+		std::mutex							m_mtxSessions;
+		std::map<std::string, SSL_SESSION*>	m_mSessions;
+	};
+
+	// settings from Client for sessions
+	struct TSessionSettings
+	{
+		std::shared_ptr<DnsCache>			m_pDnsCache;
+		SocketOptions						m_Socket;
+		std::shared_ptr<TLSSessionCache>	m_pTLSSessions;
+		bool								m_bEarlyData = false;
+		uint64_t							m_uBodyMemoryLimit = SpillBuffer::uDefaultThreshold;
+		std::optional<uint64_t>				m_uMaxBodySize;
+		bool								m_bHandshake = true;	// TLS handshake in connecting, or delay it to the first request
+	};
+
+	template<typename TStreamType>
+	class TAbsSession : public Session
+	{
+	public:
+		TAbsSession(boost::asio::io_context& ctxAsio, const TSessionSettings& rSettings) : m_Resolver(ctxAsio), m_Settings(rSettings){}
+
+		virtual bool IsOpen() const override
+		{
+			return boost::beast::get_lowest_layer(*m_tStream).is_open();
+		}
+
+		virtual const URL& GetURL() const override
+		{
+			return m_Url;
+		}
+
+		virtual void SetURL(const URL& rURL) override
+		{
+			m_Url = rURL;
+		}
+
+		virtual RequestError TryRequest() override
 		{
 			namespace http = boost::beast::http;    // from <boost/beast/http.hpp>
 
-			// Declare a container to hold the response
-			http::response<http::string_body> res;
+			// Set up an HTTP GET request message
+			auto mRequest = BuildRequest();
+
+			// Send the HTTP request to the remote host
+			boost::system::error_code ec;
+			http::write(*m_tStream, mRequest, ec);
+			return ec ? RequestError(EPhase::Write, ec) : RequestError();
+		}
+
+		virtual Result<THttpResponse> TryRead() override
+		{
+			namespace http = boost::beast::http;    // from <boost/beast/http.hpp>
 
 			// Receive the HTTP response
-			http::read(*m_tStream, m_Buffer, res);
+			InitParser();
+			boost::system::error_code ec;
+			http::read(*m_tStream, m_Buffer, *m_pParser, ec);
+			if (ec)
+				return RequestError(EPhase::Read, ec);
+			return m_pParser->release();
+		}
 
-			return res;
+		virtual void AsyncRequest(TErrorHandler funcHandler) override
+		{
+			namespace http = boost::beast::http;    // from <boost/beast/http.hpp>
+
+			// the request must be kept until the operation is completed
+			m_Request = BuildRequest();
+			http::async_write(*m_tStream, m_Request, [funcHandler](boost::system::error_code ec, std::size_t) {
+				funcHandler(ec ? RequestError(EPhase::Write, ec) : RequestError());
+			});
+		}
+
+		virtual void AsyncRead(TReadHandler funcHandler) override
+		{
+			namespace http = boost::beast::http;    // from <boost/beast/http.hpp>
+
+			InitParser();
+			http::async_read(*m_tStream, m_Buffer, *m_pParser, [this, funcHandler](boost::system::error_code ec, std::size_t) {
+				if (ec)
+					funcHandler(RequestError(EPhase::Read, ec));
+				else
+					funcHandler(m_pParser->release());
+			});
+		}
+
+	protected:
+		void InitParser()
+		{
+			// Large body is moved to a temporary file, so the size is not limited by memory
+			m_pParser = std::make_unique<boost::beast::http::response_parser<SpillBody>>();
+			// the limit of Beast is not used, it doesn't work well in some versions
+			m_pParser->body_limit(std::numeric_limits<std::uint64_t>::max());
+			m_pParser->get().body().SetThreshold(m_Settings.m_uBodyMemoryLimit);
+			m_pParser->get().body().SetLimit(m_Settings.m_uMaxBodySize);
+		}
+
+		// call the handler later on the I/O thread, so it is never called in the initiating function
+		void PostResult(TErrorHandler funcHandler, const RequestError& rError)
+		{
+			boost::asio::post(m_Resolver.get_executor(), [funcHandler, rError]() { funcHandler(rError); });
+		}
+
+		boost::beast::http::request<boost::beast::http::string_body> BuildRequest() const
+		{
+			namespace http = boost::beast::http;    // from <boost/beast/http.hpp>
+
+			http::request<http::string_body> mRequest{ http::verb::get, m_Url.getTarget(), m_iHttpVersion };
+			mRequest.set(http::field::host, HostHeader());
+			mRequest.set(http::field::user_agent, BOOST_BEAST_VERSION_STRING);
+			return mRequest;
+		}
+
+		virtual std::string HostHeader() const
+		{
+			return m_Url.m_sHost;
+		}
+
+		// resolve the host of m_Url and connect to it
+		RequestError ConnectTCP(boost::asio::ip::tcp::socket& rSocket)
+		{
+			boost::system::error_code ec;
+
+			// Look up the domain name
+			auto const vEndpoints = Resolve(ec);
+			if (ec)
+				return RequestError(EPhase::Resolve, ec);
+
+			// Make the connection on the IP address we get from a lookup
+			ec = ConnectSocket(rSocket, vEndpoints);
+			if (ec)
+				return RequestError(EPhase::Connect, ec);
+			return RequestError();
+		}
+
+		// connect to the first endpoint which works, socket options are set before connecting
+		boost::system::error_code ConnectSocket(boost::asio::ip::tcp::socket& rSocket, const std::vector<boost::asio::ip::tcp::endpoint>& vEndpoints)
+		{
+			boost::system::error_code ec = boost::asio::error::host_not_found;
+			for (const auto& rEndpoint : vEndpoints)
+			{
+				ec = OpenSocket(rSocket, rEndpoint.protocol(), vEndpoints.size() == 1);
+				if (ec)
+					continue;
+
+				rSocket.connect(rEndpoint, ec);
+				if (!ec)
+					break;
+			}
+			return ec;
+		}
+
+		// the asynchronous version of ConnectTCP()
+		void AsyncConnectTCP(boost::asio::ip::tcp::socket& rSocket, TErrorHandler funcHandler)
+		{
+			using tcp = boost::asio::ip::tcp;       // from <boost/asio/ip/tcp.hpp>
+
+			auto vEndpoints = CachedEndpoints();
+			if (vEndpoints)
+			{
+				AsyncConnectSocket(rSocket, std::make_shared<const std::vector<tcp::endpoint>>(std::move(*vEndpoints)), 0, funcHandler, boost::asio::error::host_not_found);
+				return;
+			}
+
+			m_Resolver.async_resolve(m_Url.m_sHost, std::to_string(m_Url.m_uPort), [this, &rSocket, funcHandler](boost::system::error_code ec, tcp::resolver::results_type mResults) {
+				if (ec)
+				{
+					funcHandler(RequestError(EPhase::Resolve, ec));
+					return;
+				}
+				AsyncConnectSocket(rSocket, std::make_shared<const std::vector<tcp::endpoint>>(CacheResults(mResults)), 0, funcHandler, boost::asio::error::host_not_found);
+			});
+		}
+
+		// try the endpoints from uIndex one by one, ecLast is reported if none works
+		void AsyncConnectSocket(boost::asio::ip::tcp::socket& rSocket, std::shared_ptr<const std::vector<boost::asio::ip::tcp::endpoint>> pEndpoints, size_t uIndex, TErrorHandler funcHandler, boost::system::error_code ecLast)
+		{
+			for (; uIndex < pEndpoints->size(); ++uIndex)
+			{
+				ecLast = OpenSocket(rSocket, (*pEndpoints)[uIndex].protocol(), pEndpoints->size() == 1);
+				if (!ecLast)
+					break;
+			}
+
+			if (uIndex >= pEndpoints->size())
+			{
+				PostResult(funcHandler, RequestError(EPhase::Connect, ecLast));
+				return;
+			}
+
+			rSocket.async_connect((*pEndpoints)[uIndex], [this, &rSocket, pEndpoints, uIndex, funcHandler](boost::system::error_code ec) {
+				if (ec)
+					AsyncConnectSocket(rSocket, pEndpoints, uIndex + 1, funcHandler, ec);
+				else
+					funcHandler(RequestError());
+			});
+		}
+
+		// open the socket and set the socket options, which must be done before connecting
+		// bFastOpen is false if there are other endpoints to try, because connect() never fails with Fast Open
+		boost::system::error_code OpenSocket(boost::asio::ip::tcp::socket& rSocket, const boost::asio::ip::tcp& mProtocol, bool bFastOpen)
+		{
+			using tcp = boost::asio::ip::tcp;       // from <boost/asio/ip/tcp.hpp>
+
+			boost::system::error_code ec;
+			rSocket.close(ec);
+			rSocket.open(mProtocol, ec);
+			if (ec)
+				return ec;
+
+			const SocketOptions& rOptions = m_Settings.m_Socket;
+			boost::system::error_code ecOption;
+			if (rOptions.m_bNoDelay)
+				rSocket.set_option(tcp::no_delay(*rOptions.m_bNoDelay), ecOption);
+			if (rOptions.m_iSendBufferSize)
+				rSocket.set_option(tcp::socket::send_buffer_size(*rOptions.m_iSendBufferSize), ecOption);
+			if (rOptions.m_iReceiveBufferSize)
+				rSocket.set_option(tcp::socket::receive_buffer_size(*rOptions.m_iReceiveBufferSize), ecOption);
+			if (rOptions.m_bKeepAlive)
+				rSocket.set_option(tcp::socket::keep_alive(*rOptions.m_bKeepAlive), ecOption);
+
+#if defined(__linux__) && defined(TCP_FASTOPEN_CONNECT)
+			// connect() returns at once, and the SYN is sent with the first write
+			if (rOptions.m_bFastOpen && bFastOpen)
+			{
+				int iEnable = 1;
+				::setsockopt(rSocket.native_handle(), IPPROTO_TCP, TCP_FASTOPEN_CONNECT, &iEnable, sizeof(iEnable));
+			}
+#endif
+			return ec;
+		}
+
+		// look up the domain name, the result in DNS cache is used first
+		std::vector<boost::asio::ip::tcp::endpoint> Resolve(boost::system::error_code& ec)
+		{
+			ec = {};
+			auto vEndpoints = CachedEndpoints();
+			if (vEndpoints)
+				return std::move(*vEndpoints);
+
+			auto mResults = m_Resolver.resolve(m_Url.m_sHost, std::to_string(m_Url.m_uPort), ec);
+			if (ec)
+				return {};
+			return CacheResults(mResults);
+		}
+
+		std::optional<std::vector<boost::asio::ip::tcp::endpoint>> CachedEndpoints() const
+		{
+			if (!m_Settings.m_pDnsCache)
+				return std::nullopt;
+
+			auto vAddresses = m_Settings.m_pDnsCache->Find(m_Url.m_sHost);
+			if (!vAddresses)
+				return std::nullopt;
+
+			std::vector<boost::asio::ip::tcp::endpoint> vEndpoints;
+			for (const auto& rAddress : *vAddresses)
+				vEndpoints.emplace_back(rAddress, m_Url.m_uPort);
+			return vEndpoints;
+		}
+
+		// the endpoints of the lookup result, which is also put into DNS cache
+		std::vector<boost::asio::ip::tcp::endpoint> CacheResults(const boost::asio::ip::tcp::resolver::results_type& mResults)
+		{
+			std::vector<boost::asio::ip::tcp::endpoint> vEndpoints;
+			DnsCache::TAddresses vAddresses;
+			for (const auto& rResult : mResults)
+			{
+				vEndpoints.push_back(rResult.endpoint());
+				vAddresses.push_back(rResult.endpoint().address());
+			}
+
+			if (m_Settings.m_pDnsCache && !vAddresses.empty())
+				m_Settings.m_pDnsCache->Insert(m_Url.m_sHost, vAddresses);
+			return vEndpoints;
 		}
 
 	protected:
@@ -70,36 +404,34 @@ namespace HttpClientLite
 		std::unique_ptr<TStreamType>	m_tStream;
 		boost::beast::flat_buffer		m_Buffer;
 		int								m_iHttpVersion = 11;
+		TSessionSettings				m_Settings;
+
+		// kept for the asynchronous operations
+		boost::beast::http::request<boost::beast::http::string_body>				m_Request;
+		std::unique_ptr<boost::beast::http::response_parser<SpillBody>>			m_pParser;
 	};
 
 	class CClientNoSSL : public TAbsSession<boost::asio::ip::tcp::socket>
 	{
 	public:
-		CClientNoSSL(boost::asio::io_context& ctxAsio) :TAbsSession(ctxAsio)
+		CClientNoSSL(boost::asio::io_context& ctxAsio, const TSessionSettings& rSettings) :TAbsSession(ctxAsio, rSettings)
 		{
 			m_tStream = std::make_unique<boost::asio::ip::tcp::socket>(ctxAsio);
 		}
 
-		virtual bool Connect(const URL& rURL) override
+		virtual RequestError TryConnect(const URL& rURL) override
 		{
 			m_Url = rURL;
-			try
-			{
-				// Look up the domain name
-				auto const mResults = m_Resolver.resolve(m_Url.m_sHost, std::to_string(m_Url.m_uPort));
-
-				// Make the connection on the IP address we get from a lookup
-				boost::asio::connect(*m_tStream, mResults.begin(), mResults.end());
-			}
-			catch (std::exception e)
-			{
-				return false;
-			}
+			return ConnectTCP(*m_tStream);
+		}
 
-			return true;
+		virtual void AsyncConnect(const URL& rURL, TErrorHandler funcHandler) override
+		{
+			m_Url = rURL;
+			AsyncConnectTCP(*m_tStream, funcHandler);
 		}
 
-		virtual void Close() override
+		virtual boost::system::error_code TryClose() override
 		{
 			boost::system::error_code ec;
 			m_tStream->shutdown(boost::asio::ip::tcp::socket::shutdown_both, ec);
@@ -107,49 +439,207 @@ namespace HttpClientLite
 			// not_connected happens sometimes
 			// so don't bother reporting it.
 			//
-			if (ec && ec != boost::system::errc::not_connected)
-				throw boost::system::system_error{ ec };
+			if (ec == boost::system::errc::not_connected)
+				ec = {};
+			return ec;
 		}
 	};
 
-	class CClientSSL : public TAbsSession<boost::asio::ssl::stream<boost::asio::ip::tcp::socket>>
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+	// plain http over a Unix domain socket, the host of URL is not resolved
+	class CClientUnix : public TAbsSession<boost::asio::local::stream_protocol::socket>
 	{
 	public:
-		CClientSSL(boost::asio::io_context& ctxAaio, boost::asio::ssl::context&	ctxSSL) : TAbsSession(ctxAaio)
+		CClientUnix(boost::asio::io_context& ctxAsio, const std::string& sSocketPath, const TSessionSettings& rSettings) : TAbsSession(ctxAsio, rSettings), m_sSocketPath(sSocketPath)
+		{
+			m_tStream = std::make_unique<boost::asio::local::stream_protocol::socket>(ctxAsio);
+		}
+
+		virtual RequestError TryConnect(const URL& rURL) override
 		{
-			m_tStream = std::make_unique<boost::asio::ssl::stream<boost::asio::ip::tcp::socket>>(ctxAaio, ctxSSL);
+			m_Url = rURL;
+
+			boost::system::error_code ec;
+			auto mEndpoint = Endpoint(ec);
+			if (!ec)
+				m_tStream->connect(*mEndpoint, ec);
+			return ec ? RequestError(EPhase::Connect, ec) : RequestError();
 		}
 
-		virtual bool Connect(const URL& rURL) override
+		virtual void AsyncConnect(const URL& rURL, TErrorHandler funcHandler) override
 		{
 			m_Url = rURL;
+
+			boost::system::error_code ec;
+			auto mEndpoint = Endpoint(ec);
+			if (ec)
+			{
+				PostResult(funcHandler, RequestError(EPhase::Connect, ec));
+				return;
+			}
+
+			m_tStream->async_connect(*mEndpoint, [funcHandler](boost::system::error_code ec) {
+				funcHandler(ec ? RequestError(EPhase::Connect, ec) : RequestError());
+			});
+		}
+
+		virtual boost::system::error_code TryClose() override
+		{
+			boost::system::error_code ec;
+			m_tStream->shutdown(boost::asio::local::stream_protocol::socket::shutdown_both, ec);
+			if (ec == boost::system::errc::not_connected)
+				ec = {};
+			return ec;
+		}
+
+	protected:
+		std::optional<boost::asio::local::stream_protocol::endpoint> Endpoint(boost::system::error_code& ec) const
+		{
 			try
 			{
-				// Set SNI Hostname (many hosts need this to handshake successfully)
-				if (!SSL_set_tlsext_host_name(m_tStream->native_handle(), m_Url.m_sHost.c_str()))
+				// the endpoint throws if the path is too long
+				return boost::asio::local::stream_protocol::endpoint(m_sSocketPath);
+			}
+			catch (boost::system::system_error& e)
+			{
+				ec = e.code();
+				return std::nullopt;
+			}
+		}
+
+		virtual std::string HostHeader() const override
+		{
+			// the host of a http+unix URL is the socket path
+			return m_Url.m_sProtocol == "http+unix" ? "localhost" : m_Url.m_sHost;
+		}
+
+	protected:
+		std::string	m_sSocketPath;
+	};
+#endif
+
+	class CClientSSL : public TAbsSession<boost::asio::ssl::stream<boost::asio::ip::tcp::socket>>
+	{
+	public:
+		CClientSSL(boost::asio::io_context& ctxAaio, const std::shared_ptr<TLSConfig>& pTLSConfig, const TSessionSettings& rSettings) : TAbsSession(ctxAaio, rSettings), m_pTLSConfig(pTLSConfig)
+		{
+			m_tStream = std::make_unique<boost::asio::ssl::stream<boost::asio::ip::tcp::socket>>(ctxAaio, pTLSConfig->Context());
+		}
+
+		virtual RequestError TryConnect(const URL& rURL) override
+		{
+			m_Url = rURL;
+			auto mError = PrepareTLS();
+			if (mError)
+				return mError;
+
+			mError = ConnectTCP(m_tStream->next_layer());
+			if (mError)
+				return mError;
+
+			bool bEarlyData = m_Settings.m_bEarlyData;
+			bool bResumed = ResumeTLSSession(bEarlyData);
+
+			// the handshake can be delayed to the first Request()
+			if (!m_Settings.m_bHandshake)
+				return RequestError();
+
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+			if (bEarlyData && bResumed)
+				return HandshakeWithEarlyData();
+#endif
+
+			return Handshake();
+		}
+
+		// early data needs the socket in blocking mode, so it's not sent by the asynchronous version
+		virtual void AsyncConnect(const URL& rURL, TErrorHandler funcHandler) override
+		{
+			m_Url = rURL;
+			auto mError = PrepareTLS();
+			if (mError)
+			{
+				PostResult(funcHandler, mError);
+				return;
+			}
+
+			AsyncConnectTCP(m_tStream->next_layer(), [this, funcHandler](RequestError mError) {
+				if (mError)
 				{
-					boost::system::error_code ec{ static_cast<int>(::ERR_get_error()), boost::asio::error::get_ssl_category() };
-					throw boost::system::system_error{ ec };
+					funcHandler(mError);
+					return;
 				}
 
-				// Look up the domain name
-				auto const results = m_Resolver.resolve(m_Url.m_sHost, std::to_string(m_Url.m_uPort));
+				bool bEarlyData = false;
+				ResumeTLSSession(bEarlyData);
+				if (m_Settings.m_bHandshake)
+					AsyncHandshake(funcHandler);
+				else
+					funcHandler(RequestError());
+			});
+		}
 
-				// Make the connection on the IP address we get from a lookup
-				boost::asio::connect(m_tStream->next_layer(), results.begin(), results.end());
+		virtual RequestError TryRequest() override
+		{
+			if (!m_bHandshaked)
+			{
+				auto mError = Handshake();
+				if (mError)
+					return mError;
+			}
 
-				// Perform the SSL handshake
-				m_tStream->handshake(ssl::stream_base::client);
+			// the request was accepted as early data
+			if (m_bRequestSent)
+			{
+				m_bRequestSent = false;
+				return RequestError();
 			}
-			catch (std::exception e)
+
+			return TAbsSession::TryRequest();
+		}
+
+		virtual void AsyncRequest(TErrorHandler funcHandler) override
+		{
+			if (!m_bHandshaked)
 			{
-				return false;
+				AsyncHandshake([this, funcHandler](RequestError mError) {
+					if (mError)
+						funcHandler(mError);
+					else
+						TAbsSession::AsyncRequest(funcHandler);
+				});
+				return;
 			}
 
-			return true;
+			// the request was accepted as early data
+			if (m_bRequestSent)
+			{
+				m_bRequestSent = false;
+				PostResult(funcHandler, RequestError());
+				return;
+			}
+
+			TAbsSession::AsyncRequest(funcHandler);
+		}
+
+		virtual Result<THttpResponse> TryRead() override
+		{
+			auto res = TAbsSession::TryRead();
+			if (res)
+				SaveTLSSession();
+			return res;
+		}
+
+		virtual void AsyncRead(TReadHandler funcHandler) override
+		{
+			TAbsSession::AsyncRead([this, funcHandler](Result<THttpResponse> res) {
+				if (res)
+					SaveTLSSession();
+				funcHandler(std::move(res));
+			});
 		}
 
-		virtual void Close() override
+		virtual boost::system::error_code TryClose() override
 		{
 			// Gracefully close the stream
 			boost::system::error_code ec;
@@ -160,60 +650,282 @@ namespace HttpClientLite
 				// http://stackoverflow.com/questions/25587403/boost-asio-ssl-async-shutdown-always-finishes-with-an-error
 				ec.assign(0, ec.category());
 			}
-			if (ec)
-			{
-				auto x = ec.message();
-				throw boost::system::system_error{ ec };
-			}
+			return ec;
 		}
-	};
 
-	std::optional<std::wstring> Session::GetBody(const THttpResponse & rResponse, const std::string sDefaultCodePage)
-	{
-		std::string sContent = rResponse.body();
-		if (sContent.size() > 0)
+	protected:
+		// SNI and the verification of host name
+		RequestError PrepareTLS()
 		{
-			std::string sEncoding = sDefaultCodePage;
-			size_t uPos = sContent.find("charset=");
-			if (uPos != std::string::npos)
+			// Set SNI Hostname (many hosts need this to handshake successfully)
+			if (!SSL_set_tlsext_host_name(m_tStream->native_handle(), m_Url.m_sHost.c_str()))
+				return RequestError(EPhase::Handshake, LastSSLError());
+
+			// Verify the certificate is issued for this host
+			boost::system::error_code ec;
+#if BOOST_VERSION >= 107300
+			m_tStream->set_verify_callback(ssl::host_name_verification(m_Url.m_sHost), ec);
+#else
+			m_tStream->set_verify_callback(ssl::rfc2818_verification(m_Url.m_sHost), ec);
+#endif
+			return ec ? RequestError(EPhase::Handshake, ec) : RequestError();
+		}
+
+		// Resume the last TLS session of this host, bEarlyData is cleared if the session can't send early data
+		bool ResumeTLSSession(bool& bEarlyData)
+		{
+			bool bResumed = false;
+			if (m_Settings.m_pTLSSessions)
 			{
-				auto uEnd = sContent.find_first_of("'\" ", uPos + 9);
-				if (uEnd != std::string::npos)
+				SSL_SESSION* pSession = m_Settings.m_pTLSSessions->Get(SessionKey());
+				if (pSession)
 				{
-					sEncoding = sContent.substr(uPos, 20);
-					sEncoding = sContent.substr(uPos + 8, uEnd - uPos - 7);
-					if (sEncoding[0] == '\"' || sEncoding[0] == '\'')
-						sEncoding = sEncoding.substr(1);
-
-					uPos = sEncoding.find_first_of("'\"");
-					if (uPos != std::string::npos)
-						sEncoding = sEncoding.substr(0, uPos);
+					bResumed = (SSL_set_session(m_tStream->native_handle(), pSession) == 1);
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+					bEarlyData = bEarlyData && bResumed && SSL_SESSION_get_max_early_data(pSession) > 0;
+#endif
+					SSL_SESSION_free(pSession);
 				}
 			}
-			return boost::locale::conv::to_utf<wchar_t>(sContent, sEncoding);
+			if (!bResumed)
+				bEarlyData = false;
+			return bResumed;
 		}
 
-		return std::optional<std::wstring>();
-	}
-
-	bool Session::SaveBinaryFile(const THttpResponse & rResponse, const std::string & sFilename)
-	{
-		std::ofstream sFile(sFilename, std::ios::binary);
-		if (sFile.is_open())
+		// TLS 1.3 session tickets are received after the handshake, so this is called after reading.
+		// A new ticket replaces the session object; the same one is saved only once per connection.
+		void SaveTLSSession()
 		{
-			auto& rData = rResponse.body();
-			sFile.write(rData.data(), rData.size());
-			sFile.close();
-			return true;
-		}
-		return false;
-	}
-}
+			if (!m_Settings.m_pTLSSessions)
+				return;
 
-using namespace HttpClientLite;
+			SSL_SESSION* pSession = SSL_get0_session(m_tStream->native_handle());
+			if (!pSession || pSession == m_pSavedSession)
+				return;
+
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+			// keep a copy, the session of a connection closed without shutdown is marked as not resumable
+			if (!SSL_SESSION_is_resumable(pSession))
+				return;
+
+			SSL_SESSION* pCopy = SSL_SESSION_dup(pSession);
+			if (!pCopy)
+				return;
+			m_Settings.m_pTLSSessions->Put(SessionKey(), pCopy);
+#else
+			m_Settings.m_pTLSSessions->Put(SessionKey(), SSL_get1_session(m_tStream->native_handle()));
+#endif
+			m_pSavedSession = pSession;
+		}
+
+		void AsyncHandshake(TErrorHandler funcHandler)
+		{
+			m_tStream->async_handshake(ssl::stream_base::client, [this, funcHandler](boost::system::error_code ec) {
+				m_bHandshaked = !ec;
+				funcHandler(ec ? RequestError(EPhase::Handshake, ec) : RequestError());
+			});
+		}
+
+		RequestError Handshake()
+		{
+			// Perform the SSL handshake
+			boost::system::error_code ec;
+			m_tStream->handshake(ssl::stream_base::client, ec);
+			m_bHandshaked = !ec;
+			return ec ? RequestError(EPhase::Handshake, ec) : RequestError();
+		}
+
+		// the error of the last failed OpenSSL call
+		static boost::system::error_code LastSSLError()
+		{
+			unsigned long uError = ::ERR_get_error();
+			if (uError == 0)
+				return boost::asio::ssl::error::stream_truncated;
+			return boost::system::error_code(static_cast<int>(uError), boost::asio::error::get_ssl_category());
+		}
+
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+		RequestError HandshakeWithEarlyData()
+		{
+			std::ostringstream ossRequest;
+			ossRequest << BuildRequest();
+			std::string sRequest = ossRequest.str();
+
+			// ssl::stream works with a memory BIO pair, and can't send early data.
+			// So the early data and the handshake use the socket directly, then the BIO pair is restored.
+			SSL* pSSL = m_tStream->native_handle();
+			BIO* pBio = SSL_get_rbio(pSSL);
+			BIO_up_ref(pBio);
+			if (SSL_set_fd(pSSL, (int)m_tStream->next_layer().native_handle()) != 1)
+			{
+				auto ec = LastSSLError();
+				SSL_set_bio(pSSL, pBio, pBio);
+				return RequestError(EPhase::Handshake, ec);
+			}
+
+			// ssl::stream sets the client mode in handshake(), but SSL_write_early_data() needs it first
+			SSL_set_connect_state(pSSL);
+			size_t uWritten = 0;
+			bool bSuccess = (SSL_write_early_data(pSSL, sRequest.data(), sRequest.size(), &uWritten) == 1) && (uWritten == sRequest.size());
+			m_bHandshaked = (SSL_do_handshake(pSSL) == 1);
+			auto ec = m_bHandshaked ? boost::system::error_code() : LastSSLError();
+			SSL_set_bio(pSSL, pBio, pBio);
+
+			m_bRequestSent = m_bHandshaked && bSuccess && (SSL_get_early_data_status(pSSL) == SSL_EARLY_DATA_ACCEPTED);
+			return ec ? RequestError(EPhase::Handshake, ec) : RequestError();
+		}
+#endif
+
+		std::string SessionKey() const
+		{
+			return m_Url.m_sHost + ":" + std::to_string(m_Url.m_uPort);
+		}
+
+	protected:
+		std::shared_ptr<TLSConfig>	m_pTLSConfig;
+		bool						m_bHandshaked = false;
+		bool						m_bRequestSent = false;
+
+		// only compared, the session is owned by the connection
+		const SSL_SESSION*			m_pSavedSession = nullptr;
+	};
+
+	Session::THttpResponse Session::Read()
+	{
+		auto res = TryRead();
+		if (!res)
+			throw boost::system::system_error{ res.error().m_ec };
+		return std::move(*res);
+	}
+
+	void Session::Close()
+	{
+		auto ec = TryClose();
+		if (ec)
+			throw boost::system::system_error{ ec };
+	}
+
+	std::optional<std::wstring> Session::GetBody(const THttpResponse & rResponse, const std::string sDefaultCodePage)
+	{
+		std::string_view sContent = rResponse.body().view();
+		if (sContent.size() > 0)
+		{
+			std::string sEncoding = sDefaultCodePage;
+			size_t uPos = sContent.find("charset=");
+			if (uPos != std::string::npos)
+			{
+				auto uEnd = sContent.find_first_of("'\" ", uPos + 9);
+				if (uEnd != std::string::npos)
+				{
+					sEncoding = std::string(sContent.substr(uPos + 8, uEnd - uPos - 7));
+					if (sEncoding[0] == '\"' || sEncoding[0] == '\'')
+						sEncoding = sEncoding.substr(1);
+
+					uPos = sEncoding.find_first_of("'\"");
+					if (uPos != std::string::npos)
+						sEncoding = sEncoding.substr(0, uPos);
+				}
+			}
+			return boost::locale::conv::to_utf<wchar_t>(sContent.data(), sContent.data() + sContent.size(), sEncoding);
+		}
+
+		return std::optional<std::wstring>();
+	}
+
+	bool Session::SaveBinaryFile(const THttpResponse & rResponse, const std::string & sFilename)
+	{
+		std::ofstream sFile(sFilename, std::ios::binary);
+		if (sFile.is_open())
+		{
+			auto sData = rResponse.body().view();
+			sFile.write(sData.data(), sData.size());
+			sFile.close();
+			return true;
+		}
+		return false;
+	}
+}
+
+using namespace HttpClientLite;
+
+#pragma region internal code
+// decode "%2F" in the host of http+unix URL
+static std::string percentDecode(const std::string& sInput)
+{
+	std::string sOutput;
+	sOutput.reserve(sInput.size());
+	for (size_t i = 0; i < sInput.size(); ++i)
+	{
+		if (sInput[i] == '%' && i + 2 < sInput.size() && std::isxdigit((unsigned char)sInput[i + 1]) && std::isxdigit((unsigned char)sInput[i + 2]))
+		{
+			sOutput.push_back((char)std::stoi(sInput.substr(i + 1, 2), nullptr, 16));
+			i += 2;
+		}
+		else
+		{
+			sOutput.push_back(sInput[i]);
+		}
+	}
+	return sOutput;
+}
+#pragma endregion
+
+#pragma region Functions of RequestError
+const char* HttpClientLite::PhaseName(EPhase ePhase)
+{
+	switch (ePhase)
+	{
+	case EPhase::None:		return "none";
+	case EPhase::Resolve:	return "resolve";
+	case EPhase::Connect:	return "connect";
+	case EPhase::Handshake:	return "handshake";
+	case EPhase::Write:		return "write";
+	case EPhase::Read:		return "read";
+	case EPhase::Redirect:	return "redirect";
+	}
+	return "unknown";
+}
+
+const boost::system::error_category& HttpClientLite::ErrorCategory()
+{
+	class CErrorCategory : public boost::system::error_category
+	{
+	public:
+		const char* name() const noexcept override
+		{
+			return "HttpClientLite";
+		}
+
+		std::string message(int iValue) const override
+		{
+			switch (static_cast<EError>(iValue))
+			{
+			case EError::InvalidURL:			return "invalid URL";
+			case EError::UnsupportedProtocol:	return "unsupported protocol";
+			case EError::TooManyRedirects:		return "too many redirects";
+			case EError::BadRedirect:			return "bad redirect location";
+			}
+			return "unknown error";
+		}
+	};
+
+	static const CErrorCategory mCategory;
+	return mCategory;
+}
+
+boost::system::error_code HttpClientLite::make_error_code(EError eError)
+{
+	return boost::system::error_code(static_cast<int>(eError), ErrorCategory());
+}
+
+std::string HttpClientLite::RequestError::message() const
+{
+	return std::string(PhaseName(m_ePhase)) + ": " + m_ec.message();
+}
+#pragma endregion
 
 #pragma region Functions of HTNLTag
-std::optional< std::pair<size_t, size_t> > HTMLTag::GetData(const std::string& sHtmlSource, size_t uBeginPos)
+std::optional< std::pair<size_t, size_t> > HTMLTag::GetData(std::string_view sHtmlSource, size_t uBeginPos)
 {
 	if (m_sTagName != "")
 	{
@@ -229,7 +941,7 @@ std::optional< std::pair<size_t, size_t> > HTMLTag::GetData(const std::string& s
 			if (uPos2 != std::string::npos)
 			{
 				// process attribute
-				std::string sAttribStr = sHtmlSource.substr(uPos1, uPos2 - uPos1);
+				std::string sAttribStr(sHtmlSource.substr(uPos1, uPos2 - uPos1));
 				boost::trim(sAttribStr);
 				size_t uStartPos = 0;
 				while (true)
@@ -282,7 +994,7 @@ std::optional< std::pair<size_t, size_t> > HTMLTag::GetData(const std::string& s
 					size_t uPos3 = sHtmlSource.find(sTagEnd, uPos2 + 1);
 					if (uPos3 != std::string::npos)
 					{
-						m_sContent = sHtmlSource.substr(uPos2 + 1, uPos3 - uPos2 - 1);
+						m_sContent = std::string(sHtmlSource.substr(uPos2 + 1, uPos3 - uPos2 - 1));
 						uPos2 = uPos3 + sTagEnd.size() - 1;
 					}
 				}
@@ -294,7 +1006,7 @@ std::optional< std::pair<size_t, size_t> > HTMLTag::GetData(const std::string& s
 	return std::optional< std::pair<size_t, size_t> >();
 }
 
-std::optional< std::pair<size_t, size_t> > HTMLTag::FindQuoteContent(const std::string& rSource, const char c, size_t uBeginPos)
+std::optional< std::pair<size_t, size_t> > HTMLTag::FindQuoteContent(std::string_view rSource, const char c, size_t uBeginPos)
 {
 	size_t uPos = rSource.find_first_of("\'\"", uBeginPos);
 	if (uPos != std::string::npos)
@@ -308,41 +1020,33 @@ std::optional< std::pair<size_t, size_t> > HTMLTag::FindQuoteContent(const std::
 #pragma endregion
 
 #pragma region Functions of HTMLParsr
-void HTMLParser::FindTag(const std::wstring& rHtml, const std::wstring& rTag, const std::map< std::wstring, std::optional<std::wstring> >& rAttribute, size_t uStartPos)
+std::optional< std::pair<size_t, std::wstring> > HTMLParser::FindTag(const std::wstring& rHtml, const std::wstring& rTag, const TAttributes& rAttribute, size_t uStartPos)
 {
-	std::wstring	sTagBegin = L"<" + rTag,
-		sTagEnd = L"</" + rTag + L">";
-
-	// find the position of tag
-	size_t uPos1 = rHtml.find(sTagBegin, uStartPos);
-	if (uPos1 == std::string::npos)
-	{
-		return;
-	}
-
-	// find the end of the start tag
-	size_t uPos2 = rHtml.find(L">", uPos1 + sTagBegin.length());
-	if (uPos2 == std::string::npos)
-	{
-		return;
-	}
+	return FindTag(DocumentIndex(rHtml), rTag, rAttribute, uStartPos);
+}
 
-	if (rAttribute.size() > 0)
+std::optional< std::pair<size_t, std::wstring> > HTMLParser::FindTag(const DocumentIndex& rIndex, const std::wstring& rTag, const TAttributes& rAttribute, size_t uStartPos)
+{
+	// the tags are in document order
+	auto vTags = rIndex.FindByTag(rTag);
+	auto itTag = std::lower_bound(vTags.begin(), vTags.end(), uStartPos, [&rIndex](uint32_t uTag, size_t uPos) { return rIndex.GetBegin(uTag) < uPos; });
+	for (; itTag != vTags.end(); ++itTag)
 	{
-		// get attributes
-		std::wstring sAttributes = rHtml.substr(uPos1 + sTagBegin.length(), uPos2 - (uPos1 + sTagBegin.length()));
-
-		// TODO: check attribute
-	}
-
-	// TODO: check nested tag?
+		bool bMatch = true;
+		for (const auto& rAttr : rAttribute)
+		{
+			auto sValue = rIndex.GetAttribute(*itTag, rAttr.first);
+			if (!sValue || (rAttr.second && *sValue != *rAttr.second))
+			{
+				bMatch = false;
+				break;
+			}
+		}
 
-	// find close tag
-	size_t uPos3 = rHtml.find(sTagEnd, uPos2 + 1);
-	if (uPos3 != std::string::npos)
-	{
-		std::wstring sContent = rHtml.substr(uPos2 + 1, uPos3 - uPos2 - 1);
+		if (bMatch)
+			return std::make_pair(rIndex.GetBegin(*itTag), std::wstring(rIndex.GetContent(*itTag)));
 	}
+	return std::optional< std::pair<size_t, std::wstring> >();
 }
 
 std::pair<size_t, std::wstring> HTMLParser::FindContentBetweenTag(const std::wstring& rHtml, const std::pair<std::wstring, std::wstring>& rTag, size_t uStartPos)
@@ -394,34 +1098,573 @@ std::optional< std::pair<std::wstring, std::wstring> > HTMLParser::AnalyzeLink(c
 }
 #pragma endregion
 
-HttpClientLite::Client::Client() : m_ctxSSL(ssl::context::sslv23_client)
+#pragma region Functions of TLSConfig
+std::shared_ptr<TLSConfig> HttpClientLite::TLSConfig::Shared()
 {
-	load_root_certificates(m_ctxSSL);
+	// kept until the process exits, so short-lived clients don't load the certificates again
+	static const std::shared_ptr<TLSConfig> pShared(new TLSConfig());
+	return pShared;
+}
+
+bool HttpClientLite::TLSConfig::HasSystemTrustStore()
+{
+	// the locations set_default_verify_paths() uses, which can be changed by SSL_CERT_FILE and SSL_CERT_DIR
+	const char* sFile = std::getenv(X509_get_default_cert_file_env());
+	const char* sDir = std::getenv(X509_get_default_cert_dir_env());
+
+	std::error_code ec;
+	if (std::filesystem::is_regular_file(sFile ? sFile : X509_get_default_cert_file(), ec))
+		return true;
+
+	std::filesystem::path pathDir(sDir ? sDir : X509_get_default_cert_dir());
+	return std::filesystem::is_directory(pathDir, ec) && !std::filesystem::is_empty(pathDir, ec);
+}
+
+HttpClientLite::TLSConfig::TLSConfig() : m_ctxSSL(ssl::context::tls_client)
+{
+	m_ctxSSL.set_options(ssl::context::default_workarounds | ssl::context::no_sslv2 | ssl::context::no_sslv3);
+
+	// trust store of system, or the embedded certificates if there is none (e.g. OpenSSL on Windows)
+	boost::system::error_code ec;
+	bool bSystemStore = HasSystemTrustStore();
+	if (bSystemStore)
+		m_ctxSSL.set_default_verify_paths(ec);
+	if (!bSystemStore || ec)
+		load_root_certificates(m_ctxSSL, ec);
+	m_ctxSSL.set_verify_mode(ssl::verify_peer);
+
+	// only HTTP/1.1 is supported
+	static const unsigned char sALPN[] = { 8, 'h', 't', 't', 'p', '/', '1', '.', '1' };
+	SSL_CTX_set_alpn_protos(m_ctxSSL.native_handle(), sALPN, sizeof(sALPN));
+}
+#pragma endregion
+
+#pragma region Functions of DnsCache
+std::optional<DnsCache::TAddresses> HttpClientLite::DnsCache::Find(const std::string& sHost)
+{
+	std::lock_guard<std::mutex> lock(m_mtxEntries);
+	auto itEntry = m_mEntries.find(sHost);
+	if (itEntry == m_mEntries.end())
+		return std::nullopt;
+
+	if (itEntry->second.m_tExpire < std::chrono::steady_clock::now())
+	{
+		m_mEntries.erase(itEntry);
+		return std::nullopt;
+	}
+	return itEntry->second.m_vAddresses;
+}
+
+void HttpClientLite::DnsCache::Insert(const std::string& sHost, const TAddresses& vAddresses)
+{
+	Insert(sHost, vAddresses, m_tTTL);
+}
+
+void HttpClientLite::DnsCache::Insert(const std::string& sHost, const TAddresses& vAddresses, std::chrono::seconds tTTL)
+{
+	std::lock_guard<std::mutex> lock(m_mtxEntries);
+	m_mEntries[sHost] = { vAddresses, std::chrono::steady_clock::now() + std::min(tTTL, m_tTTL) };
+}
+
+std::vector<DnsCache::TRecord> HttpClientLite::DnsCache::Export()
+{
+	std::vector<TRecord> vRecords;
+	std::lock_guard<std::mutex> lock(m_mtxEntries);
+	auto tNow = std::chrono::steady_clock::now();
+	for (auto& rEntry : m_mEntries)
+	{
+		auto tRemaining = std::chrono::duration_cast<std::chrono::seconds>(rEntry.second.m_tExpire - tNow);
+		if (tRemaining.count() > 0)
+			vRecords.push_back({ rEntry.first, rEntry.second.m_vAddresses, tRemaining });
+	}
+	return vRecords;
+}
+#pragma endregion
+
+HttpClientLite::Client::Client(const ClientOptions& rOptions) : m_Options(rOptions), m_pDnsCache(std::make_shared<DnsCache>(rOptions.m_tDnsTTL)), m_pTLSSessions(std::make_shared<TLSSessionCache>())
+{
+	// one io_context per I/O thread, so there is no lock contention between threads
+	size_t uContexts = std::max<size_t>(m_Options.m_uIOThreads, 1);
+	for (size_t i = 0; i < uContexts; ++i)
+		m_vCtxAsio.push_back(std::make_unique<boost::asio::io_context>(1));
+
+	for (size_t i = 0; i < m_Options.m_uIOThreads; ++i)
+	{
+		boost::asio::io_context& rCtx = *m_vCtxAsio[i];
+		m_vWorkGuards.push_back(boost::asio::make_work_guard(rCtx));
+		m_vIOThreads.emplace_back([this, &rCtx]() { RunIOContext(rCtx); });
+	}
+}
+
+HttpClientLite::Client::~Client()
+{
+	for (auto& rGuard : m_vWorkGuards)
+		rGuard.reset();
+	for (auto& pCtx : m_vCtxAsio)
+		pCtx->stop();
+	for (auto& rThread : m_vIOThreads)
+		rThread.join();
+}
+
+std::shared_ptr<TLSConfig> HttpClientLite::Client::GetTLSConfig()
+{
+	// the certificates are loaded only when the client uses https
+	std::call_once(m_onceTLS, [this]() { m_pTLSConfig = TLSConfig::Shared(); });
+	return m_pTLSConfig;
+}
+
+boost::asio::io_context& HttpClientLite::Client::NextContext()
+{
+	return *m_vCtxAsio[m_uNextContext.fetch_add(1, std::memory_order_relaxed) % m_vCtxAsio.size()];
+}
+
+void HttpClientLite::Client::RunIOContext(boost::asio::io_context& rCtx)
+{
+	// an exception from a handler must not end the thread, other sessions still need it
+	for (;;)
+	{
+		try
+		{
+			rCtx.run();
+			return;
+		}
+		catch (std::exception& e)
+		{
+			m_sigErrorLog(std::string("Exception in I/O thread: ") + e.what());
+		}
+	}
+}
+
+void HttpClientLite::Client::StartIOThread()
+{
+	if (m_Options.m_uIOThreads > 0)
+		return;
+
+	// there is only one io_context without I/O threads
+	std::call_once(m_onceIOThread, [this]() {
+		boost::asio::io_context& rCtx = *m_vCtxAsio[0];
+		m_vWorkGuards.push_back(boost::asio::make_work_guard(rCtx));
+		m_vIOThreads.emplace_back([this, &rCtx]() { RunIOContext(rCtx); });
+	});
 }
 
 std::shared_ptr<Session> HttpClientLite::Client::Connect(const URL& rURL)
 {
-	if (rURL)
+	auto res = TryConnect(rURL);
+	return res ? *res : nullptr;
+}
+
+Result<std::shared_ptr<Session>> HttpClientLite::Client::TryConnect(const URL& rURL)
+{
+	// an idle connection may be closed by the server, and the caller can't tell it from other errors
+	return CreateSession(rURL);
+}
+
+Result<std::shared_ptr<Session>> HttpClientLite::Client::CreateSession(const URL& rURL)
+{
+	auto res = MakeSession(rURL);
+	if (!res)
+		return res;
+
+	auto mError = (*res)->TryConnect(rURL);
+	if (mError)
+		return mError;
+	return res;
+}
+
+void HttpClientLite::Client::AsyncConnect(const URL& rURL, TConnectHandler funcHandler)
+{
+	StartIOThread();
+
+	auto res = MakeSession(rURL);
+	if (!res)
 	{
-		std::shared_ptr< Session> pSession;
-		if (rURL.m_sProtocol == "http")
-			pSession = std::make_shared<CClientNoSSL>(m_ctxAaio);
-		else if (rURL.m_sProtocol == "https")
-			pSession = std::make_shared<CClientSSL>(m_ctxAaio, m_ctxSSL);
+		boost::asio::post(NextContext(), [funcHandler, mError = res.error()]() { funcHandler(mError); });
+		return;
+	}
 
-		if (pSession)
-			if(pSession->Connect(rURL))
-				return pSession;
+	auto pSession = *res;
+	pSession->AsyncConnect(rURL, [pSession, funcHandler](RequestError mError) {
+		if (mError)
+			funcHandler(mError);
+		else
+			funcHandler(pSession);
+	});
+}
+
+Result<std::shared_ptr<Session>> HttpClientLite::Client::MakeSession(const URL& rURL)
+{
+	return MakeSession(rURL, SessionSettings());
+}
+
+Result<std::shared_ptr<Session>> HttpClientLite::Client::MakeSession(const URL& rURL, const TSessionSettings& rSettings)
+{
+	if (!rURL)
+		return RequestError(EPhase::Connect, EError::InvalidURL);
+
+	std::shared_ptr< Session> pSession;
+	auto sSocketPath = UnixSocketPath(rURL);
+	if (sSocketPath)
+	{
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+		pSession = std::make_shared<CClientUnix>(NextContext(), *sSocketPath, rSettings);
+#else
+		return RequestError(EPhase::Connect, EError::UnsupportedProtocol);
+#endif
+	}
+	else if (rURL.m_sProtocol == "http")
+		pSession = std::make_shared<CClientNoSSL>(NextContext(), rSettings);
+	else if (rURL.m_sProtocol == "https")
+		pSession = std::make_shared<CClientSSL>(NextContext(), GetTLSConfig(), rSettings);
+	else
+		return RequestError(EPhase::Connect, EError::UnsupportedProtocol);
+
+	return pSession;
+}
+
+TSessionSettings HttpClientLite::Client::SessionSettings() const
+{
+	return TSessionSettings{ m_pDnsCache, m_Options.m_Socket, m_pTLSSessions, m_Options.m_bEarlyData, m_Options.m_uBodyMemoryLimit, m_Options.m_uMaxBodySize };
+}
+
+std::string HttpClientLite::Client::HostKey(const URL& rURL)
+{
+	// the host of http+unix is a file path, which may be case-sensitive
+	if (rURL.m_sProtocol == "http+unix")
+		return rURL.m_sProtocol + "://" + rURL.m_sHost;
+	return boost::algorithm::to_lower_copy(rURL.m_sProtocol + "://" + rURL.m_sHost) + ":" + std::to_string(rURL.m_uPort);
+}
+
+std::optional<std::string> HttpClientLite::Client::UnixSocketPath(const URL& rURL)
+{
+	if (rURL.m_sProtocol == "http+unix")
+		return percentDecode(rURL.m_sHost);
+
+	if (rURL.m_sProtocol != "http")
+		return std::nullopt;
+
+	std::lock_guard<std::mutex> lock(m_mtxRoutes);
+	if (m_mUnixRoutes.empty())
+		return std::nullopt;
+
+	auto itRoute = m_mUnixRoutes.find(HostKey(rURL));
+	if (itRoute == m_mUnixRoutes.end())
+		return std::nullopt;
+	return itRoute->second;
+}
+
+void HttpClientLite::Client::RouteToUnixSocket(const URL& rURL, const std::string& sSocketPath)
+{
+	std::string sKey = HostKey(rURL);
+	{
+		std::lock_guard<std::mutex> lock(m_mtxRoutes);
+		if (sSocketPath.empty())
+			m_mUnixRoutes.erase(sKey);
+		else
+			m_mUnixRoutes[sKey] = sSocketPath;
+	}
+
+	// the idle connections are made by the old route
+	std::lock_guard<std::mutex> lock(m_mtxIdle);
+	auto itHost = m_mIdle.find(sKey);
+	if (itHost != m_mIdle.end())
+	{
+		m_uIdleCount -= itHost->second.size();
+		m_mIdle.erase(itHost);
+	}
+}
+
+std::shared_ptr<Session> HttpClientLite::Client::TakeIdle(const URL& rURL)
+{
+	std::shared_ptr<Session> pSession;
+	{
+		std::lock_guard<std::mutex> lock(m_mtxIdle);
+		auto itHost = m_mIdle.find(HostKey(rURL));
+		if (itHost == m_mIdle.end())
+			return nullptr;
+
+		// the oldest ones are in the front
+		auto& qSessions = itHost->second;
+		auto tExpire = std::chrono::steady_clock::now() - m_Options.m_tIdleTimeout;
+		while (!qSessions.empty() && qSessions.front().m_tIdleSince < tExpire)
+		{
+			qSessions.pop_front();
+			--m_uIdleCount;
+		}
+
+		while (!qSessions.empty() && !pSession)
+		{
+			if (qSessions.back().m_pSession->IsOpen())
+				pSession = qSessions.back().m_pSession;
+			qSessions.pop_back();
+			--m_uIdleCount;
+		}
+
+		if (qSessions.empty())
+			m_mIdle.erase(itHost);
+	}
+
+	if (pSession)
+		pSession->SetURL(rURL);
+	return pSession;
+}
+
+bool HttpClientLite::Client::ReservePreconnect(const URL& rURL, size_t uMax)
+{
+	std::string sKey = HostKey(rURL);
+	std::lock_guard<std::mutex> lock(m_mtxIdle);
+	auto itHost = m_mIdle.find(sKey);
+	size_t& rConnecting = m_mPreconnecting[sKey];
+	if ((itHost == m_mIdle.end() ? 0 : itHost->second.size()) + rConnecting >= uMax)
+	{
+		if (rConnecting == 0)
+			m_mPreconnecting.erase(sKey);
+		return false;
+	}
+
+	++rConnecting;
+	return true;
+}
+
+void HttpClientLite::Client::FinishPreconnect(const URL& rURL)
+{
+	std::lock_guard<std::mutex> lock(m_mtxIdle);
+	auto itHost = m_mPreconnecting.find(HostKey(rURL));
+	if (itHost != m_mPreconnecting.end() && --itHost->second == 0)
+		m_mPreconnecting.erase(itHost);
+}
+
+void HttpClientLite::Client::Release(std::shared_ptr<Session> pSession)
+{
+	if (!pSession || !pSession->IsOpen() || m_Options.m_uMaxIdlePerHost == 0 || m_Options.m_uMaxIdle == 0)
+		return;
+
+	std::lock_guard<std::mutex> lock(m_mtxIdle);
+	auto& qSessions = m_mIdle[HostKey(pSession->GetURL())];
+	if (qSessions.size() >= m_Options.m_uMaxIdlePerHost)
+	{
+		qSessions.pop_front();
+		--m_uIdleCount;
+	}
+
+	// drop the oldest idle connection of all hosts
+	if (m_uIdleCount >= m_Options.m_uMaxIdle)
+	{
+		auto itOldest = m_mIdle.end();
+		for (auto itHost = m_mIdle.begin(); itHost != m_mIdle.end(); ++itHost)
+		{
+			if (!itHost->second.empty() && (itOldest == m_mIdle.end() || itHost->second.front().m_tIdleSince < itOldest->second.front().m_tIdleSince))
+				itOldest = itHost;
+		}
+		if (itOldest != m_mIdle.end())
+		{
+			itOldest->second.pop_front();
+			--m_uIdleCount;
+		}
+	}
+
+	qSessions.push_back({ pSession, std::chrono::steady_clock::now() });
+	++m_uIdleCount;
+}
+
+void HttpClientLite::Client::Preconnect(const URL& rURL, bool bHandshake)
+{
+	// a connection can be used only once if the server closes it after the response
+	size_t uMaxIdle = KnownToClose(rURL) ? std::min<size_t>(m_Options.m_uMaxIdlePerHost, 1) : m_Options.m_uMaxIdlePerHost;
+	StartPreconnect(rURL, bHandshake, uMaxIdle);
+}
+
+void HttpClientLite::Client::StartPreconnect(const URL& rURL, bool bHandshake, size_t uMax)
+{
+	// the connections in progress are counted, so concurrent calls don't open more than the limit
+	if (!rURL || !ReservePreconnect(rURL, uMax))
+		return;
+
+	StartIOThread();
+
+	// no early data, the request is unknown yet
+	TSessionSettings mSettings = SessionSettings();
+	mSettings.m_bHandshake = bHandshake;
+	mSettings.m_bEarlyData = false;
+
+	// with TCP Fast Open, connect() returns before the SYN is sent, so the idle socket would not be connected
+	mSettings.m_Socket.m_bFastOpen = false;
+
+	auto res = MakeSession(rURL, mSettings);
+	if (!res)
+	{
+		FinishPreconnect(rURL);
+		m_sigErrorLog("Preconnect to <" + rURL.toString() + "> failed: " + res.error().message());
+		return;
+	}
+
+	auto pSession = *res;
+	pSession->AsyncConnect(rURL, [this, pSession, rURL](RequestError mError) {
+		if (mError)
+			m_sigErrorLog("Preconnect to <" + rURL.toString() + "> failed: " + mError.message());
+		else
+			Release(pSession);
+		FinishPreconnect(rURL);
+	});
+}
+
+void HttpClientLite::Client::PrefetchDns(const std::string& sHost)
+{
+	if (sHost.empty() || m_pDnsCache->Find(sHost))
+		return;
+
+	StartIOThread();
+
+	// the resolver is kept by the handler
+	auto pResolver = std::make_shared<boost::asio::ip::tcp::resolver>(NextContext());
+	pResolver->async_resolve(sHost, "", [this, pResolver, sHost](boost::system::error_code ec, boost::asio::ip::tcp::resolver::results_type mResults) {
+		if (ec)
+			return;
+
+		DnsCache::TAddresses vAddresses;
+		for (const auto& rResult : mResults)
+			vAddresses.push_back(rResult.endpoint().address());
+		if (!vAddresses.empty())
+			m_pDnsCache->Insert(sHost, vAddresses);
+	});
+}
+
+void HttpClientLite::Client::PrewarmLinks(const URL& rURL, const std::wstring& sHtml)
+{
+	// count the links of each host
+	std::map<std::string, std::pair<size_t, URL>> mHosts;
+	for (size_t uPos = sHtml.find(L"<a "); uPos != std::wstring::npos; uPos = sHtml.find(L"<a ", uPos + 3))
+	{
+		auto pLink = HTMLParser::AnalyzeLink(sHtml, uPos);
+		if (!pLink)
+			break;
+
+		URL mLink = rURL.resolve(boost::locale::conv::utf_to_utf<char>(pLink->second));
+		if (!mLink || (mLink.m_sProtocol != "http" && mLink.m_sProtocol != "https"))
+			continue;
+
+		auto& rHost = mHosts[HostKey(mLink)];
+		if (rHost.first++ == 0)
+		{
+			rHost.second = mLink;
+			rHost.second.m_sPath = "/";
+			rHost.second.m_vGetData.clear();
+		}
 	}
-	return nullptr;
+
+	std::vector<std::pair<size_t, URL>> vHosts;
+	for (auto& rHost : mHosts)
+		vHosts.push_back(rHost.second);
+	std::sort(vHosts.begin(), vHosts.end(), [](const auto& rA, const auto& rB) { return rA.first > rB.first; });
+
+	// hosts which already have an idle or connecting session are skipped
+	for (size_t i = 0; i < vHosts.size() && i < m_Options.m_uPrewarmHosts; ++i)
+		StartPreconnect(vHosts[i].second, true, 1);
 }
 
-std::optional<std::wstring> HttpClientLite::Client::ReadHtml(const URL & rURL, const std::string sDefaultCodePage)
+Result<Client::TSharedResponse> HttpClientLite::Client::Fetch(const URL& rURL, URL* pFinalURL)
 {
-	auto Resp = ReadWithAuroRedirect(rURL);
-	if (Resp.result_int() == 200)
+	// the response with the URL it is read from
+	using TFetched = std::pair<Result<TSharedResponse>, URL>;
+	auto funcRead = [this](const URL& rTarget) -> TFetched {
+		URL mFinalURL = rTarget;
+		auto res = ReadWithAuroRedirect(rTarget, 10, &mFinalURL);
+		if (!res)
+			return { res.error(), mFinalURL };
+		return { TSharedResponse(std::make_shared<const Session::THttpResponse>(std::move(*res))), mFinalURL };
+	};
+	auto funcResult = [pFinalURL](const TFetched& rFetched) {
+		if (pFinalURL)
+			*pFinalURL = rFetched.second;
+		return rFetched.first;
+	};
+
+	if (!m_Options.m_bCoalesceRequests)
+		return funcResult(funcRead(rURL));
+
+	// the first request of the URL downloads it, others wait for the result
+	std::string sKey = rURL.toCanonicalString();
+	std::promise<TFetched> pmResult;
+	std::shared_future<TFetched> ftResult;
+	bool bFirst = false;
+	{
+		std::lock_guard<std::mutex> lock(m_mtxInFlight);
+		auto itFlight = m_mInFlight.find(sKey);
+		if (itFlight == m_mInFlight.end())
+		{
+			itFlight = m_mInFlight.emplace(sKey, pmResult.get_future().share()).first;
+			bFirst = true;
+		}
+		ftResult = itFlight->second;
+	}
+
+	if (!bFirst)
+		return funcResult(ftResult.get());
+
+	std::optional<TFetched> res;
+	try
+	{
+		res = funcRead(rURL);
+	}
+	catch (...)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mtxInFlight);
+			m_mInFlight.erase(sKey);
+		}
+		pmResult.set_exception(std::current_exception());
+		throw;
+	}
+
 	{
-		return Session::GetBody(Resp, sDefaultCodePage);
+		std::lock_guard<std::mutex> lock(m_mtxInFlight);
+		m_mInFlight.erase(sKey);
+	}
+	pmResult.set_value(*res);
+	return funcResult(*res);
+}
+
+void HttpClientLite::Client::AsyncFetch(const URL& rURL, TFetchHandler funcHandler)
+{
+	StartIOThread();
+	AsyncReadWithRedirect(rURL, 10, [funcHandler](Result<Session::THttpResponse> res) {
+		if (!res)
+			funcHandler(res.error());
+		else
+			funcHandler(TSharedResponse(std::make_shared<const Session::THttpResponse>(std::move(*res))));
+	});
+}
+
+Client::TSharedResponse HttpClientLite::Client::ReadResponse(const URL& rURL, URL* pFinalURL)
+{
+	auto res = Fetch(rURL, pFinalURL);
+	if (res)
+		return *res;
+
+	m_sigErrorLog("Read <" + rURL.toString() + "> failed: " + res.error().message());
+	auto pResponse = std::make_shared<Session::THttpResponse>();
+	pResponse->result(boost::beast::http::status::unknown);
+	return pResponse;
+}
+
+std::optional<std::wstring> HttpClientLite::Client::ReadHtml(const URL & rURL, const std::string sDefaultCodePage, URL* pFinalURL)
+{
+	URL mFinalURL = rURL;
+	auto pResp = ReadResponse(rURL, &mFinalURL);
+	if (pFinalURL)
+		*pFinalURL = mFinalURL;
+	if (pResp->result_int() == 200)
+	{
+		if (pResp->body().size() > m_Options.m_uMaxHtmlSize)
+		{
+			m_sigErrorLog("Read <" + mFinalURL.toString() + "> failed: the page is larger than " + std::to_string(m_Options.m_uMaxHtmlSize) + " bytes");
+			return std::optional<std::wstring>();
+		}
+
+		auto sBody = Session::GetBody(*pResp, sDefaultCodePage);
+		if (sBody && m_Options.m_uPrewarmHosts > 0)
+			PrewarmLinks(mFinalURL, *sBody);
+		return sBody;
 	}
 
 	return std::optional<std::wstring>();
@@ -429,11 +1672,11 @@ std::optional<std::wstring> HttpClientLite::Client::ReadHtml(const URL & rURL, c
 
 bool HttpClientLite::Client::GetBinaryFile(const URL & rURL, const std::wstring & sFilename)
 {
-	auto Resp = ReadWithAuroRedirect(rURL);
-	auto sContent = Resp.body();
-	if (sContent.size() > 0)
+	auto pResp = ReadResponse(rURL);
+	std::string_view sContent = pResp->body().view();
+	if (pResp->result_int() == 200 && sContent.size() > 0)
 	{
-		std::ofstream fsFile(sFilename, std::ios_base::binary);
+		std::ofstream fsFile(std::filesystem::path(sFilename), std::ios_base::binary);
 		if (fsFile.is_open())
 		{
 			fsFile.write(sContent.data(), sContent.size() );
@@ -444,20 +1687,506 @@ bool HttpClientLite::Client::GetBinaryFile(const URL & rURL, const std::wstring
 	return false;
 }
 
-Session::THttpResponse HttpClientLite::Client::ReadWithAuroRedirect(const URL & rURL)
+Result<Session::THttpResponse> HttpClientLite::Client::ReadWithAuroRedirect(const URL & rURL, int iRedirectLimit, URL* pFinalURL)
 {
-	auto pSession = Connect(rURL);
-	if (pSession->Request())
+	URL mURL = ApplyKnownRedirects(rURL);
+
+	// the idle connection may be closed by server, try again with a new connection
+	for (int iTry = 0; ; ++iTry)
 	{
-		auto res = pSession->Read();
-		if (res.result_int() == 200)
+		std::shared_ptr<Session> pSession = (iTry == 0) ? TakeIdle(mURL) : nullptr;
+		bool bReused = (pSession != nullptr);
+		if (!pSession)
+		{
+			auto resSession = CreateSession(mURL);
+			if (!resSession)
+				return resSession.error();
+			pSession = *resSession;
+		}
+
+		auto mError = pSession->TryRequest();
+		auto res = mError ? Result<Session::THttpResponse>(mError) : pSession->TryRead();
+		if (!res)
+		{
+			if (bReused)
+				continue;
+			return res;
+		}
+
+		UpdateHostInfo(mURL, *res);
+		if (res->keep_alive())
+			Release(pSession);
+
+		auto resTarget = RedirectTarget(mURL, *res, iRedirectLimit);
+		if (!resTarget)
+			return resTarget.error();
+		if (!*resTarget)
+		{
+			if (pFinalURL)
+				*pFinalURL = mURL;
 			return res;
+		}
 
-		if (res.result_int() / 100 == 3) // 300 redirect
-			return ReadWithAuroRedirect(URL(res[boost::beast::http::field::location].to_string()));
+		return ReadWithAuroRedirect(**resTarget, iRedirectLimit - 1, pFinalURL);
+	}
+}
+
+void HttpClientLite::Client::AsyncReadWithRedirect(const URL& rURL, int iRedirectLimit, TResponseHandler funcHandler)
+{
+	URL mURL = ApplyKnownRedirects(rURL);
 
-		pSession->Close();
+	auto pSession = TakeIdle(mURL);
+	if (pSession)
+	{
+		AsyncReadOn(pSession, true, mURL, iRedirectLimit, funcHandler);
+		return;
 	}
 
-	return Session::THttpResponse();
+	AsyncConnect(mURL, [this, mURL, iRedirectLimit, funcHandler](Result<std::shared_ptr<Session>> resSession) {
+		if (!resSession)
+			funcHandler(resSession.error());
+		else
+			AsyncReadOn(*resSession, false, mURL, iRedirectLimit, funcHandler);
+	});
+}
+
+void HttpClientLite::Client::AsyncReadOn(std::shared_ptr<Session> pSession, bool bReused, const URL& rURL, int iRedirectLimit, TResponseHandler funcHandler)
+{
+	// the idle connection may be closed by server, try again with a new connection
+	auto funcFailed = [this, bReused, rURL, iRedirectLimit, funcHandler](const RequestError& rError) {
+		if (!bReused)
+		{
+			funcHandler(rError);
+			return;
+		}
+
+		AsyncConnect(rURL, [this, rURL, iRedirectLimit, funcHandler](Result<std::shared_ptr<Session>> resSession) {
+			if (!resSession)
+				funcHandler(resSession.error());
+			else
+				AsyncReadOn(*resSession, false, rURL, iRedirectLimit, funcHandler);
+		});
+	};
+
+	pSession->AsyncRequest([this, pSession, rURL, iRedirectLimit, funcHandler, funcFailed](RequestError mError) {
+		if (mError)
+		{
+			funcFailed(mError);
+			return;
+		}
+
+		pSession->AsyncRead([this, pSession, rURL, iRedirectLimit, funcHandler, funcFailed](Result<Session::THttpResponse> res) {
+			if (!res)
+			{
+				funcFailed(res.error());
+				return;
+			}
+
+			UpdateHostInfo(rURL, *res);
+			if (res->keep_alive())
+				Release(pSession);
+
+			auto resTarget = RedirectTarget(rURL, *res, iRedirectLimit);
+			if (!resTarget)
+				funcHandler(resTarget.error());
+			else if (!*resTarget)
+				funcHandler(std::move(res));
+			else
+				AsyncReadWithRedirect(**resTarget, iRedirectLimit - 1, funcHandler);
+		});
+	});
+}
+
+Result<std::optional<URL>> HttpClientLite::Client::RedirectTarget(const URL& rURL, const Session::THttpResponse& rResponse, int iRedirectLimit)
+{
+	namespace http = boost::beast::http;    // from <boost/beast/http.hpp>
+
+	// 304 is not a redirection, and 3xx without Location is returned as it is
+	unsigned int uStatus = rResponse.result_int();
+	auto sLocation = rResponse[http::field::location];
+	if (uStatus / 100 != 3 || uStatus == 304 || sLocation.empty())
+		return std::optional<URL>();
+
+	if (iRedirectLimit <= 0)
+		return RequestError(EPhase::Redirect, EError::TooManyRedirects);
+
+	URL mTarget = rURL.resolve(std::string(sLocation));
+	if (!mTarget || (mTarget.m_sProtocol != "http" && mTarget.m_sProtocol != "https" && mTarget.m_sProtocol != "http+unix"))
+		return RequestError(EPhase::Redirect, EError::BadRedirect);
+
+	return std::optional<URL>(mTarget);
+}
+
+#pragma region Functions of Client state
+// HSTS hosts, permanent redirections and host flags are not saved after this number
+static const size_t		uMaxHostInfo = 4096;
+
+static const char		sStateMagic[4] = { 'H', 'C', 'L', 'S' };
+static const uint32_t	uStateVersion = 1;
+
+template<typename T>
+static void writeValue(std::ostream& rStream, const T& rValue)
+{
+	rStream.write(reinterpret_cast<const char*>(&rValue), sizeof(T));
+}
+
+static void writeString(std::ostream& rStream, const std::string& sValue)
+{
+	writeValue(rStream, (uint32_t)sValue.size());
+	rStream.write(sValue.data(), sValue.size());
+}
+
+// "<file>.<pid>-<random>.tmp" in the same directory, so processes and threads saving the same file don't share it
+static std::filesystem::path uniqueTempPath(const std::filesystem::path& pathFile)
+{
+	static std::atomic<uint32_t> uCounter{ std::random_device()() };
+#ifdef _WIN32
+	int iProcess = _getpid();
+#else
+	int iProcess = (int)getpid();
+#endif
+	std::filesystem::path pathTemp = pathFile;
+	pathTemp += "." + std::to_string(iProcess) + "-" + std::to_string(uCounter++) + ".tmp";
+	return pathTemp;
 }
+
+// read values from the mapped file without copying the whole file
+class CStateReader
+{
+public:
+	CStateReader(const char* pData, size_t uSize) : m_pData(pData), m_uSize(uSize) {}
+
+	template<typename T>
+	bool readValue(T& rValue)
+	{
+		if (m_uSize - m_uPos < sizeof(T))
+			return false;
+
+		std::memcpy(&rValue, m_pData + m_uPos, sizeof(T));
+		m_uPos += sizeof(T);
+		return true;
+	}
+
+	bool readString(std::string& sValue)
+	{
+		uint32_t uSize = 0;
+		if (!readValue(uSize) || m_uSize - m_uPos < uSize)
+			return false;
+
+		sValue.assign(m_pData + m_uPos, uSize);
+		m_uPos += uSize;
+		return true;
+	}
+
+protected:
+	const char*	m_pData;
+	size_t		m_uSize;
+	size_t		m_uPos = 0;
+};
+
+URL HttpClientLite::Client::ApplyKnownRedirects(const URL& rURL)
+{
+	URL mURL = rURL;
+	std::lock_guard<std::mutex> lock(m_mtxHostInfo);
+	for (int iHop = 0; iHop < 10; ++iHop)
+	{
+		if (mURL.m_sProtocol == "http" && !m_mHSTS.empty())
+		{
+			// the host, or a parent domain with includeSubDomains
+			std::string sHost = boost::algorithm::to_lower_copy(mURL.m_sHost);
+			int64_t iNow = (int64_t)std::time(nullptr);
+			for (size_t uPos = 0; uPos != std::string::npos; uPos = sHost.find('.', uPos + 1))
+			{
+				auto itHSTS = m_mHSTS.find(uPos == 0 ? sHost : sHost.substr(uPos + 1));
+				if (itHSTS != m_mHSTS.end() && itHSTS->second.m_iExpire > iNow && (uPos == 0 || itHSTS->second.m_bSubDomains))
+				{
+					mURL.m_sProtocol = "https";
+					if (mURL.m_uPort == 80)
+						mURL.m_uPort = 443;
+					break;
+				}
+			}
+		}
+
+		auto itRedirect = m_mPermanentRedirects.find(mURL.toCanonicalString());
+		if (itRedirect == m_mPermanentRedirects.end())
+			break;
+
+		URL mTarget(itRedirect->second);
+		if (!mTarget)
+			break;
+		mURL = mTarget;
+	}
+	return mURL;
+}
+
+void HttpClientLite::Client::UpdateHostInfo(const URL& rURL, const Session::THttpResponse& rResponse)
+{
+	namespace http = boost::beast::http;
+
+	std::lock_guard<std::mutex> lock(m_mtxHostInfo);
+	std::string sHostKey = HostKey(rURL);
+	auto itFlags = m_mHostFlags.find(sHostKey);
+	if (itFlags != m_mHostFlags.end() || m_mHostFlags.size() < uMaxHostInfo)
+	{
+		uint8_t& uFlags = m_mHostFlags[sHostKey];
+		uFlags = rResponse.keep_alive() ? (uFlags | HostKeepAlive) : (uFlags & ~HostKeepAlive);
+	}
+
+	// Strict-Transport-Security: max-age=31536000; includeSubDomains
+	auto itHSTS = rResponse.find(http::field::strict_transport_security);
+	if (rURL.m_sProtocol == "https" && itHSTS != rResponse.end())
+	{
+		std::vector<std::string> vDirectives;
+		std::string sValue = std::string(itHSTS->value());
+		boost::algorithm::split(vDirectives, sValue, boost::algorithm::is_any_of(";"));
+
+		std::optional<int64_t> iMaxAge;
+		bool bSubDomains = false;
+		for (auto& sDirective : vDirectives)
+		{
+			boost::algorithm::trim(sDirective);
+			boost::algorithm::to_lower(sDirective);
+			if (sDirective.compare(0, 8, "max-age=") == 0)
+			{
+				std::string sAge = boost::algorithm::trim_copy_if(sDirective.substr(8), boost::algorithm::is_any_of("\""));
+				try
+				{
+					iMaxAge = std::stoll(sAge);
+				}
+				catch (std::exception&)
+				{
+				}
+			}
+			else if (sDirective == "includesubdomains")
+			{
+				bSubDomains = true;
+			}
+		}
+
+		std::string sHost = boost::algorithm::to_lower_copy(rURL.m_sHost);
+		if (iMaxAge && *iMaxAge <= 0)
+			m_mHSTS.erase(sHost);
+		else if (iMaxAge && (m_mHSTS.count(sHost) > 0 || m_mHSTS.size() < uMaxHostInfo))
+			m_mHSTS[sHost] = { (int64_t)std::time(nullptr) + *iMaxAge, bSubDomains };
+	}
+
+	// 301 Moved Permanently and 308 Permanent Redirect can be cached
+	if (rResponse.result() == http::status::moved_permanently || rResponse.result() == http::status::permanent_redirect)
+	{
+		URL mTarget = rURL.resolve(std::string(rResponse[http::field::location]));
+		std::string sSource = rURL.toCanonicalString();
+		if (mTarget && mTarget.toCanonicalString() != sSource && (m_mPermanentRedirects.count(sSource) > 0 || m_mPermanentRedirects.size() < uMaxHostInfo))
+			m_mPermanentRedirects[sSource] = mTarget.toString();
+	}
+}
+
+bool HttpClientLite::Client::KnownToClose(const URL& rURL)
+{
+	std::lock_guard<std::mutex> lock(m_mtxHostInfo);
+	auto itFlags = m_mHostFlags.find(HostKey(rURL));
+	return itFlags != m_mHostFlags.end() && (itFlags->second & HostKeepAlive) == 0;
+}
+
+bool HttpClientLite::Client::SaveState(const std::string& sFilename)
+{
+	// write to a temporary file and rename it, so other processes never load a partial file
+	std::filesystem::path pathFile(sFilename);
+	std::filesystem::path pathTemp = uniqueTempPath(pathFile);
+	bool bWritten = false;
+	{
+		std::ofstream fsFile(pathTemp, std::ios::binary | std::ios::trunc);
+		if (!fsFile.is_open())
+			return false;
+
+		fsFile.write(sStateMagic, sizeof(sStateMagic));
+		writeValue(fsFile, uStateVersion);
+		writeValue(fsFile, (int64_t)std::time(nullptr));
+
+		auto vDnsRecords = m_pDnsCache->Export();
+		writeValue(fsFile, (uint32_t)vDnsRecords.size());
+		for (const auto& rRecord : vDnsRecords)
+		{
+			writeString(fsFile, rRecord.m_sHost);
+			writeValue(fsFile, (int64_t)rRecord.m_tRemaining.count());
+			writeValue(fsFile, (uint32_t)rRecord.m_vAddresses.size());
+			for (const auto& rAddress : rRecord.m_vAddresses)
+				writeString(fsFile, rAddress.to_string());
+		}
+
+		auto vSessions = m_pTLSSessions->Export();
+		writeValue(fsFile, (uint32_t)vSessions.size());
+		for (const auto& rSession : vSessions)
+		{
+			writeString(fsFile, rSession.first);
+			writeString(fsFile, rSession.second);
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(m_mtxHostInfo);
+			writeValue(fsFile, (uint32_t)m_mHSTS.size());
+			for (const auto& rEntry : m_mHSTS)
+			{
+				writeString(fsFile, rEntry.first);
+				writeValue(fsFile, rEntry.second.m_iExpire);
+				writeValue(fsFile, (uint8_t)rEntry.second.m_bSubDomains);
+			}
+
+			writeValue(fsFile, (uint32_t)m_mPermanentRedirects.size());
+			for (const auto& rRedirect : m_mPermanentRedirects)
+			{
+				writeString(fsFile, rRedirect.first);
+				writeString(fsFile, rRedirect.second);
+			}
+
+			writeValue(fsFile, (uint32_t)m_mHostFlags.size());
+			for (const auto& rFlags : m_mHostFlags)
+			{
+				writeString(fsFile, rFlags.first);
+				writeValue(fsFile, rFlags.second);
+			}
+		}
+
+		bWritten = static_cast<bool>(fsFile.flush());
+	}
+
+	std::error_code ec;
+	if (bWritten)
+		std::filesystem::rename(pathTemp, pathFile, ec);
+	if (!bWritten || ec)
+	{
+		// don't leave the partial file
+		std::filesystem::remove(pathTemp, ec);
+		return false;
+	}
+	return true;
+}
+
+bool HttpClientLite::Client::LoadState(const std::string& sFilename)
+{
+	namespace bip = boost::interprocess;
+
+	bip::file_mapping mFile;
+	bip::mapped_region mRegion;
+	try
+	{
+		mFile = bip::file_mapping(sFilename.c_str(), bip::read_only);
+		mRegion = bip::mapped_region(mFile, bip::read_only);
+	}
+	catch (bip::interprocess_exception&)
+	{
+		return false;
+	}
+
+	CStateReader mReader(static_cast<const char*>(mRegion.get_address()), mRegion.get_size());
+	char sMagic[4];
+	uint32_t uVersion = 0, uCount = 0;
+	int64_t iSavedTime = 0;
+	if (!mReader.readValue(sMagic) || std::memcmp(sMagic, sStateMagic, sizeof(sMagic)) != 0)
+		return false;
+	if (!mReader.readValue(uVersion) || uVersion != uStateVersion || !mReader.readValue(iSavedTime))
+		return false;
+
+	// read all sections before changing anything, a broken file is ignored
+	int64_t iElapsed = std::max<int64_t>(0, (int64_t)std::time(nullptr) - iSavedTime);
+	std::vector<DnsCache::TRecord> vDnsRecords;
+	if (!mReader.readValue(uCount))
+		return false;
+	for (uint32_t i = 0; i < uCount; ++i)
+	{
+		DnsCache::TRecord mRecord;
+		int64_t iRemaining = 0;
+		uint32_t uAddresses = 0;
+		if (!mReader.readString(mRecord.m_sHost) || !mReader.readValue(iRemaining) || !mReader.readValue(uAddresses))
+			return false;
+
+		for (uint32_t j = 0; j < uAddresses; ++j)
+		{
+			std::string sAddress;
+			if (!mReader.readString(sAddress))
+				return false;
+
+			boost::system::error_code ec;
+			auto mAddress = boost::asio::ip::make_address(sAddress, ec);
+			if (!ec)
+				mRecord.m_vAddresses.push_back(mAddress);
+		}
+
+		mRecord.m_tRemaining = std::chrono::seconds(iRemaining - iElapsed);
+		if (mRecord.m_tRemaining.count() > 0 && !mRecord.m_vAddresses.empty())
+			vDnsRecords.push_back(std::move(mRecord));
+	}
+
+	std::vector<std::pair<std::string, std::string>> vSessions;
+	if (!mReader.readValue(uCount))
+		return false;
+	for (uint32_t i = 0; i < uCount; ++i)
+	{
+		std::pair<std::string, std::string> mSession;
+		if (!mReader.readString(mSession.first) || !mReader.readString(mSession.second))
+			return false;
+		vSessions.push_back(std::move(mSession));
+	}
+
+	std::map<std::string, THSTSEntry> mHSTS;
+	if (!mReader.readValue(uCount))
+		return false;
+	for (uint32_t i = 0; i < uCount; ++i)
+	{
+		std::string sHost;
+		THSTSEntry mEntry;
+		uint8_t uSubDomains = 0;
+		if (!mReader.readString(sHost) || !mReader.readValue(mEntry.m_iExpire) || !mReader.readValue(uSubDomains))
+			return false;
+
+		mEntry.m_bSubDomains = (uSubDomains != 0);
+		mHSTS[sHost] = mEntry;
+	}
+
+	std::map<std::string, std::string> mRedirects;
+	if (!mReader.readValue(uCount))
+		return false;
+	for (uint32_t i = 0; i < uCount; ++i)
+	{
+		std::string sSource, sTarget;
+		if (!mReader.readString(sSource) || !mReader.readString(sTarget))
+			return false;
+		mRedirects[sSource] = sTarget;
+	}
+
+	std::map<std::string, uint8_t> mFlags;
+	if (!mReader.readValue(uCount))
+		return false;
+	for (uint32_t i = 0; i < uCount; ++i)
+	{
+		std::string sHostKey;
+		uint8_t uFlags = 0;
+		if (!mReader.readString(sHostKey) || !mReader.readValue(uFlags))
+			return false;
+		mFlags[sHostKey] = uFlags;
+	}
+
+	// what is learned by this process is kept
+	for (const auto& rRecord : vDnsRecords)
+		if (!m_pDnsCache->Find(rRecord.m_sHost))
+			m_pDnsCache->Insert(rRecord.m_sHost, rRecord.m_vAddresses, rRecord.m_tRemaining);
+
+	for (const auto& rSession : vSessions)
+	{
+		SSL_SESSION* pSession = m_pTLSSessions->Get(rSession.first);
+		if (pSession)
+			SSL_SESSION_free(pSession);
+		else
+			m_pTLSSessions->Import(rSession.first, rSession.second);
+	}
+
+	std::lock_guard<std::mutex> lock(m_mtxHostInfo);
+	int64_t iNow = (int64_t)std::time(nullptr);
+	for (const auto& rEntry : mHSTS)
+		if (rEntry.second.m_iExpire > iNow)
+			m_mHSTS.insert(rEntry);
+	m_mPermanentRedirects.insert(mRedirects.begin(), mRedirects.end());
+	m_mHostFlags.insert(mFlags.begin(), mFlags.end());
+	return true;
+}
+#pragma endregion
@@ -1,9 +1,19 @@
 #pragma once
 
 // STL Header
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <future>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <string_view>
 #include <optional>
+#include <thread>
+#include <vector>
 
 // Boost Header
 #include <boost/asio.hpp>
@@ -13,6 +23,7 @@
 #include <boost/beast/http/string_body.hpp>
 
 #include "url.h"
+#include "SpillBody.h"
 
 namespace HttpClientLite
 {
@@ -32,18 +43,19 @@ namespace HttpClientLite
 			m_sTagName = sTagName;
 		}
 
-		HTMLTag(const std::string& sTagName, const std::string& sHtmlSource, size_t uBeginPos = 0)
+		HTMLTag(const std::string& sTagName, std::string_view sHtmlSource, size_t uBeginPos = 0)
 		{
 			m_sTagName = sTagName;
 			GetData(sHtmlSource, uBeginPos);
 		}
 
-		std::optional< std::pair<size_t, size_t> > GetData(const std::string& sHtmlSource, size_t uBeginPos = 0);
+		// sHtmlSource can be the view of a response body
+		std::optional< std::pair<size_t, size_t> > GetData(std::string_view sHtmlSource, size_t uBeginPos = 0);
 
-		std::optional< std::pair<size_t, size_t> > FindQuoteContent(const std::string& rSourze, const char c, size_t uBeginPos = 0);
+		std::optional< std::pair<size_t, size_t> > FindQuoteContent(std::string_view rSourze, const char c, size_t uBeginPos = 0);
 
 	public:
-		static std::optional< std::pair< HTMLTag, std::pair<size_t, size_t> > > Construct(const std::string& sTagName, std::string& sHtmlSource, size_t uBeginPos = 0)
+		static std::optional< std::pair< HTMLTag, std::pair<size_t, size_t> > > Construct(const std::string& sTagName, std::string_view sHtmlSource, size_t uBeginPos = 0)
 		{
 			HTMLTag mTag(sTagName);
 			std::optional< std::pair<size_t, size_t> > pInfo = mTag.GetData(sHtmlSource, uBeginPos);
@@ -54,35 +66,307 @@ namespace HttpClientLite
 		}
 	};
 
+	class DocumentIndex;
+
 	class HTMLParser
 	{
 	public:
 		typedef std::map< std::wstring, std::optional<std::wstring> >	TAttributes;
 
 	public:
-		static void FindTag(const std::wstring& rHtml, const std::wstring& rTag, const std::map< std::wstring, std::optional<std::wstring> >& rAttribute, size_t uStartPos = 0);
+		/**
+		 * Find the first tag after uStartPos which has all the attributes (std::nullopt means any value).
+		 * Return the position of the start tag and the content.
+		 * Build a DocumentIndex and use the second version if there are many queries on the same document.
+		 */
+		static std::optional< std::pair<size_t, std::wstring> > FindTag(const std::wstring& rHtml, const std::wstring& rTag, const TAttributes& rAttribute, size_t uStartPos = 0);
+		static std::optional< std::pair<size_t, std::wstring> > FindTag(const DocumentIndex& rIndex, const std::wstring& rTag, const TAttributes& rAttribute, size_t uStartPos = 0);
 
 		static std::pair<size_t, std::wstring> FindContentBetweenTag(const std::wstring& rHtml, const std::pair<std::wstring, std::wstring>& rTag, size_t uStartPos = 0);
 
 		static std::optional< std::pair<std::wstring, std::wstring> > AnalyzeLink(const std::wstring& rHtml, size_t uStartPos = 0);
 	};
 
+	// the step of a request which failed
+	enum class EPhase
+	{
+		None,
+		Resolve,
+		Connect,
+		Handshake,
+		Write,
+		Read,
+		Redirect
+	};
+
+	const char* PhaseName(EPhase ePhase);
+
+	// errors of HttpClientLite itself, others are from Asio, Beast and OpenSSL
+	enum class EError
+	{
+		InvalidURL = 1,
+		UnsupportedProtocol,	// only http, https and http+unix are supported
+		TooManyRedirects,
+		BadRedirect				// the Location of a redirection is not a valid http or https URL
+	};
+
+	const boost::system::error_category& ErrorCategory();
+	boost::system::error_code make_error_code(EError eError);
+
+	/**
+	 * Why a request failed: the error and the phase where it happened.
+	 * Like boost::system::error_code, it's true when there is an error.
+	 */
+	class RequestError
+	{
+	public:
+		EPhase						m_ePhase = EPhase::None;
+		boost::system::error_code	m_ec;
+
+	public:
+		RequestError() = default;
+		RequestError(EPhase ePhase, const boost::system::error_code& ec) : m_ePhase(ePhase), m_ec(ec){}
+
+		explicit operator bool() const
+		{
+			return m_ePhase != EPhase::None;
+		}
+
+		// e.g. "connect: Connection refused"
+		std::string message() const;
+	};
+
+	/**
+	 * The value, or the error if failed.
+	 */
+	template<typename T>
+	class Result
+	{
+	public:
+		Result(T tValue) : m_Value(std::move(tValue)){}
+		Result(const RequestError& rError) : m_Error(rError){}
+
+		explicit operator bool() const
+		{
+			return m_Value.has_value();
+		}
+
+		T& value()
+		{
+			return *m_Value;
+		}
+
+		const T& value() const
+		{
+			return *m_Value;
+		}
+
+		T& operator*()
+		{
+			return *m_Value;
+		}
+
+		const T& operator*() const
+		{
+			return *m_Value;
+		}
+
+		T* operator->()
+		{
+			return &*m_Value;
+		}
+
+		const T* operator->() const
+		{
+			return &*m_Value;
+		}
+
+		const RequestError& error() const
+		{
+			return m_Error;
+		}
+
+	protected:
+		std::optional<T>	m_Value;
+		RequestError		m_Error;
+	};
+
 	class Session
 	{
 	public:
-		using THttpResponse = boost::beast::http::response<boost::beast::http::string_body>;
+		// use body().view() to get the data, it may be mapped from a temporary file
+		using THttpResponse = boost::beast::http::response<SpillBody>;
 
 	public:
-		virtual bool Connect(const URL& rURL) = 0;
-		virtual bool Request() = 0; //TODO: need to modify request
-		virtual THttpResponse Read() = 0;
-		virtual void Close() = 0;
+		virtual ~Session() = default;
+
+		// return false or throw boost::system::system_error if failed
+		bool Connect(const URL& rURL)
+		{
+			return !TryConnect(rURL);
+		}
+
+		bool Request() //TODO: need to modify request
+		{
+			return !TryRequest();
+		}
+
+		THttpResponse Read();
+		void Close();
+
+		// no-throw versions, which return the reason of failure
+		virtual RequestError TryConnect(const URL& rURL) = 0;
+		virtual RequestError TryRequest() = 0;
+		virtual Result<THttpResponse> TryRead() = 0;
+		virtual boost::system::error_code TryClose() = 0;
+
+		/**
+		 * Asynchronous versions, the handler is called by the thread which runs the io_context of the session.
+		 * Only one operation at a time, and the session should be kept until the handler is called.
+		 */
+		using TErrorHandler = std::function<void(RequestError)>;
+		using TReadHandler = std::function<void(Result<THttpResponse>)>;
+
+		virtual void AsyncConnect(const URL& rURL, TErrorHandler funcHandler) = 0;
+		virtual void AsyncRequest(TErrorHandler funcHandler) = 0;
+		virtual void AsyncRead(TReadHandler funcHandler) = 0;
+
+		virtual bool IsOpen() const = 0;
+		virtual const URL& GetURL() const = 0;
+
+		// change the target of next Request(), the host should be the same
+		virtual void SetURL(const URL& rURL) = 0;
 
 	public:
 		static std::optional<std::wstring> GetBody(const THttpResponse& rResponse, const std::string sDefaultCodePage = "us-ascii");
 		static bool SaveBinaryFile(const THttpResponse& rResponse, const std::string& sFilename);
 	};
 
+	/**
+	 * TLS settings shared by all Client in the process.
+	 * It's created when the first https connection is made, and kept until the process exits.
+	 */
+	class TLSConfig
+	{
+	public:
+		static std::shared_ptr<TLSConfig> Shared();
+
+		// the context is not modified after constructed; it's non-const only because ssl::stream needs it
+		boost::asio::ssl::context& Context()
+		{
+			return m_ctxSSL;
+		}
+
+	protected:
+		TLSConfig();
+
+		static bool HasSystemTrustStore();
+
+	protected:
+		boost::asio::ssl::context	m_ctxSSL;
+	};
+
+	/**
+	 * Addresses of host names, shared by the sessions of a Client.
+	 */
+	class DnsCache
+	{
+	public:
+		using TAddresses = std::vector<boost::asio::ip::address>;
+
+	public:
+		// an entry with the remaining time to live, for Client::SaveState()
+		struct TRecord
+		{
+			std::string				m_sHost;
+			TAddresses				m_vAddresses;
+			std::chrono::seconds	m_tRemaining;
+		};
+
+	public:
+		DnsCache(std::chrono::seconds tTTL) : m_tTTL(tTTL){}
+
+		std::optional<TAddresses> Find(const std::string& sHost);
+		void Insert(const std::string& sHost, const TAddresses& vAddresses);
+		void Insert(const std::string& sHost, const TAddresses& vAddresses, std::chrono::seconds tTTL);
+
+		// entries which are not expired
+		std::vector<TRecord> Export();
+
+	protected:
+		struct TEntry
+		{
+			TAddresses								m_vAddresses;
+			std::chrono::steady_clock::time_point	m_tExpire;
+		};
+
+		std::chrono::seconds			m_tTTL;
+		std::mutex						m_mtxEntries;
+		std::map<std::string, TEntry>	m_mEntries;
+	};
+
+	class SocketOptions
+	{
+	public:
+		// not changed if not set
+		std::optional<bool>	m_bNoDelay;
+		std::optional<int>	m_iSendBufferSize;
+		std::optional<int>	m_iReceiveBufferSize;
+		std::optional<bool>	m_bKeepAlive;
+
+		// TCP Fast Open (Linux only), the first data is sent with SYN if the host was connected before.
+		// connect() succeeds at once, so an unreachable server is reported as a failure of writing the request.
+		// Only used when the host resolves to one address, otherwise the next address couldn't be tried.
+		// Not used by Preconnect(), which has no data to send.
+		bool				m_bFastOpen = false;
+	};
+
+	class ClientOptions
+	{
+	public:
+		// Number of I/O threads, each one runs its own io_context and sessions are distributed between them.
+		// The asynchronous API (AsyncConnect(), AsyncFetch() and Session::Async*()) runs on them,
+		// the blocking functions always work in the caller thread.
+		// If 0, one I/O thread is started by the first asynchronous call.
+		size_t	m_uIOThreads = 0;
+
+		// Concurrent requests of the same URL share one download and the same response object.
+		bool	m_bCoalesceRequests = false;
+
+		// Keep-alive connections are kept for next requests of the same host
+		size_t					m_uMaxIdlePerHost = 4;
+		size_t					m_uMaxIdle = 64;
+		std::chrono::seconds	m_tIdleTimeout{ 30 };
+
+		// How long the result of name resolution is used
+		std::chrono::seconds	m_tDnsTTL{ 60 };
+
+		// Preconnect() to the top N hosts linked by the page read by ReadHtml()
+		size_t					m_uPrewarmHosts = 0;
+
+		SocketOptions			m_Socket;
+
+		// Send the GET request as TLS 1.3 early data (0-RTT) when the TLS session of the host can be resumed.
+		// The request is sent again if the server rejects the early data.
+		bool					m_bEarlyData = false;
+
+		// Response body larger than this is moved to a temporary file and mapped to memory when completed
+		uint64_t				m_uBodyMemoryLimit = SpillBuffer::uDefaultThreshold;
+
+		// Reading fails if the response body is larger than this; no limit if reset
+		std::optional<uint64_t>	m_uMaxBodySize = 1024 * 1024 * 1024;
+
+		// ReadHtml() fails if the page is larger than this, because the decoded text takes up to 4 times the size in memory
+		uint64_t				m_uMaxHtmlSize = 8 * 1024 * 1024;
+	};
+
+	class TLSSessionCache;
+	struct TSessionSettings;
+
+	/**
+	 * Client can be used from any thread at the same time.
+	 * A Session returned by Connect() should be used by only one thread at a time.
+	 */
 	class Client
 	{
 	public:
@@ -90,11 +374,57 @@ namespace HttpClientLite
 		boost::signals2::signal<void(const std::string&)>	m_sigInfoLog;
 
 	public:
-		Client();
+		using TSharedResponse = std::shared_ptr<const Session::THttpResponse>;
+
+	public:
+		Client(const ClientOptions& rOptions = ClientOptions());
+		~Client();
 
+		Client(const Client&) = delete;
+		Client& operator=(const Client&) = delete;
+
+		// make a new connection, idle connections are only used by Fetch() which retries if the server closed it; nullptr if failed
 		std::shared_ptr<Session> Connect(const URL& rURL);
+		Result<std::shared_ptr<Session>> TryConnect(const URL& rURL);
+
+		// keep the connection for the next request of the same host, it's closed if it can't be kept
+		void Release(std::shared_ptr<Session> pSession);
+
+		// resolve the host name, connect and do TLS handshake on an I/O thread, and keep the connection as idle.
+		// They return at once.
+		void Preconnect(const URL& rURL, bool bHandshake = true);
+		void PrefetchDns(const std::string& sHost);
+
+		/**
+		 * Connect to a Unix domain socket instead of TCP for the http host and port of rURL, e.g. a local proxy.
+		 * The Host header is not changed. An empty path removes the route.
+		 * A socket can also be given by URL like "http+unix://%2Frun%2Fproxy.sock/path", the Host header is "localhost".
+		 * Only works where Asio supports local sockets.
+		 */
+		void RouteToUnixSocket(const URL& rURL, const std::string& sSocketPath);
+
+		/**
+		 * Read the response with redirection, the final response is returned whatever the status is.
+		 * It never throws, and the phase and the error are returned if failed.
+		 * pFinalURL receives the URL of the final response, the base of its relative links.
+		 */
+		Result<TSharedResponse> Fetch(const URL& rURL, URL* pFinalURL = nullptr);
+
+		// the same as Fetch(), but the error is only logged; never returns nullptr, the status is 0 if failed
+		TSharedResponse ReadResponse(const URL& rURL, URL* pFinalURL = nullptr);
+
+		/**
+		 * Asynchronous versions of TryConnect() and Fetch(), they return at once and the I/O threads do the work.
+		 * The handler is called on an I/O thread, so it shouldn't block. Requests are not coalesced.
+		 * Pending handlers are not called if the Client is destroyed.
+		 */
+		using TConnectHandler = std::function<void(Result<std::shared_ptr<Session>>)>;
+		using TFetchHandler = std::function<void(Result<TSharedResponse>)>;
 
-		std::optional<std::wstring> ReadHtml(const URL& rURL, const std::string sDefaultCodePage = "us-ascii");
+		void AsyncConnect(const URL& rURL, TConnectHandler funcHandler);
+		void AsyncFetch(const URL& rURL, TFetchHandler funcHandler);
+
+		std::optional<std::wstring> ReadHtml(const URL& rURL, const std::string sDefaultCodePage = "us-ascii", URL* pFinalURL = nullptr);
 		std::optional<std::wstring> ReadHtml(const std::string& sURL, const std::string sDefaultCodePage = "us-ascii")
 		{
 			return ReadHtml(URL(sURL),sDefaultCodePage);
@@ -106,12 +436,112 @@ namespace HttpClientLite
 			return GetBinaryFile(URL(sURL), sFilename);
 		}
 
+		/**
+		 * Save what is learned from previous requests, so a new process can start warm with LoadState():
+		 * DNS cache, TLS sessions, HSTS hosts, permanent redirections and keep-alive support of hosts.
+		 * Idle connections are not saved.
+		 */
+		bool SaveState(const std::string& sFilename);
+		bool LoadState(const std::string& sFilename);
+
 	protected:
-		Session::THttpResponse ReadWithAuroRedirect(const URL& rURL);
+		Result<Session::THttpResponse> ReadWithAuroRedirect(const URL& rURL, int iRedirectLimit = 10, URL* pFinalURL = nullptr);
+
+		using TResponseHandler = std::function<void(Result<Session::THttpResponse>)>;
+		void AsyncReadWithRedirect(const URL& rURL, int iRedirectLimit, TResponseHandler funcHandler);
+		void AsyncReadOn(std::shared_ptr<Session> pSession, bool bReused, const URL& rURL, int iRedirectLimit, TResponseHandler funcHandler);
+
+		// the URL to follow if the response is a redirection, or the error if it can't be followed
+		Result<std::optional<URL>> RedirectTarget(const URL& rURL, const Session::THttpResponse& rResponse, int iRedirectLimit);
+
+		// the session is not connected
+		Result<std::shared_ptr<Session>> MakeSession(const URL& rURL);
+		Result<std::shared_ptr<Session>> MakeSession(const URL& rURL, const TSessionSettings& rSettings);
+
+		Result<std::shared_ptr<Session>> CreateSession(const URL& rURL);
+		TSessionSettings SessionSettings() const;
+		std::shared_ptr<Session> TakeIdle(const URL& rURL);
+
+		// connect in background if the idle and connecting sessions of the host are fewer than uMax
+		void StartPreconnect(const URL& rURL, bool bHandshake, size_t uMax);
+		bool ReservePreconnect(const URL& rURL, size_t uMax);
+		void FinishPreconnect(const URL& rURL);
+		void PrewarmLinks(const URL& rURL, const std::wstring& sHtml);
+
+		static std::string HostKey(const URL& rURL);
+
+		// the Unix domain socket of the URL if it's routed or a http+unix URL
+		std::optional<std::string> UnixSocketPath(const URL& rURL);
+
+		// use https for HSTS hosts, and follow the cached permanent redirections
+		URL ApplyKnownRedirects(const URL& rURL);
+		void UpdateHostInfo(const URL& rURL, const Session::THttpResponse& rResponse);
+		bool KnownToClose(const URL& rURL);
+
+		// get the io_context for a new session in round-robin
+		boost::asio::io_context& NextContext();
+
+		// make sure the io_context of every session is run by a thread, before an asynchronous operation
+		void StartIOThread();
+		void RunIOContext(boost::asio::io_context& rCtx);
+
+		std::shared_ptr<TLSConfig> GetTLSConfig();
 
 	protected:
-		boost::asio::io_context		m_ctxAaio;
-		boost::asio::ssl::context	m_ctxSSL;
-		int							m_iHttpVersion = 11;
+		using TWorkGuard = boost::asio::executor_work_guard<boost::asio::io_context::executor_type>;
+
+		ClientOptions											m_Options;
+		std::vector<std::unique_ptr<boost::asio::io_context>>	m_vCtxAsio;
+		std::vector<TWorkGuard>									m_vWorkGuards;
+		std::vector<std::thread>								m_vIOThreads;
+		std::atomic<size_t>										m_uNextContext{ 0 };
+		std::once_flag											m_onceIOThread;
+		std::mutex												m_mtxInFlight;
+		std::map<std::string, std::shared_future<std::pair<Result<TSharedResponse>, URL>>>	m_mInFlight;
+		std::shared_ptr<DnsCache>								m_pDnsCache;
+		std::shared_ptr<TLSSessionCache>						m_pTLSSessions;
+
+		struct TIdleSession
+		{
+			std::shared_ptr<Session>				m_pSession;
+			std::chrono::steady_clock::time_point	m_tIdleSince;
+		};
+		std::mutex												m_mtxIdle;
+		std::map<std::string, std::deque<TIdleSession>>			m_mIdle;
+		size_t													m_uIdleCount = 0;
+		std::map<std::string, size_t>							m_mPreconnecting;
+
+		// HSTS policy of a host name
+		struct THSTSEntry
+		{
+			int64_t	m_iExpire;		// seconds since epoch
+			bool	m_bSubDomains;
+		};
+
+		// what is known about a host (HostKey)
+		enum EHostFlag : uint8_t
+		{
+			HostKeepAlive = 0x01,	// the server keeps the connection after a response
+		};
+
+		std::mutex												m_mtxHostInfo;
+		std::map<std::string, THSTSEntry>						m_mHSTS;
+		std::map<std::string, std::string>						m_mPermanentRedirects;	// canonical URL to the target
+		std::map<std::string, uint8_t>							m_mHostFlags;
+
+		std::mutex												m_mtxRoutes;
+		std::map<std::string, std::string>						m_mUnixRoutes;	// HostKey to the socket path
+
+		std::once_flag											m_onceTLS;
+		std::shared_ptr<TLSConfig>								m_pTLSConfig;
+		int														m_iHttpVersion = 11;
+	};
+}
+
+namespace boost::system
+{
+	template<>
+	struct is_error_code_enum<HttpClientLite::EError> : std::true_type
+	{
 	};
 }
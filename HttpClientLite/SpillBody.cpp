@@ -0,0 +1,234 @@
+// STL Header
+#include <atomic>
+#include <filesystem>
+#include <random>
+#include <utility>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+// Application Header
+#include "SpillBody.h"
+
+using namespace HttpClientLite;
+
+#pragma region internal code
+// data are written to the file in blocks of this size after spilled
+static const size_t uWriteBlockSize = 64 * 1024;
+
+#ifdef _WIN32
+static HANDLE createTempFile()
+{
+	// the file is deleted by system when the handle is closed, even if the process crashes
+	static std::atomic<uint32_t> uCounter{ std::random_device()() };
+	std::filesystem::path pathTemp = std::filesystem::temp_directory_path();
+	for (int i = 0; i < 16; ++i)
+	{
+		std::filesystem::path pathFile = pathTemp / ("HttpClientLite-" + std::to_string(GetCurrentProcessId()) + "-" + std::to_string(uCounter++) + ".tmp");
+		HANDLE hFile = CreateFileW(pathFile.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_NEW, FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, nullptr);
+		if (hFile != INVALID_HANDLE_VALUE)
+			return hFile;
+		if (GetLastError() != ERROR_FILE_EXISTS)
+			break;
+	}
+	return nullptr;
+}
+#else
+static int createTempFile()
+{
+	std::error_code ec;
+	std::filesystem::path pathTemp = std::filesystem::temp_directory_path(ec);
+	if (ec)
+		pathTemp = "/tmp";
+
+	int iFile = -1;
+#ifdef O_TMPFILE
+	// a file without name, Linux only
+	iFile = open(pathTemp.c_str(), O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+	if (iFile >= 0)
+		return iFile;
+#endif
+
+	// remove the name right after created, the data are released when the file is closed
+	std::string sTemplate = (pathTemp / "HttpClientLite-XXXXXX").string();
+	iFile = mkstemp(&sTemplate[0]);
+	if (iFile >= 0)
+	{
+		unlink(sTemplate.c_str());
+		fcntl(iFile, F_SETFD, FD_CLOEXEC);
+	}
+	return iFile;
+}
+#endif
+#pragma endregion
+
+#pragma region Functions of SpillBuffer
+SpillBuffer::SpillBuffer(SpillBuffer&& rOther) noexcept
+{
+	*this = std::move(rOther);
+}
+
+SpillBuffer& SpillBuffer::operator=(SpillBuffer&& rOther) noexcept
+{
+	if (this != &rOther)
+	{
+		clear();
+		m_uThreshold = rOther.m_uThreshold;
+		m_uLimit = rOther.m_uLimit;
+		m_uSize = std::exchange(rOther.m_uSize, 0);
+		m_sMemory = std::move(rOther.m_sMemory);
+		rOther.m_sMemory.clear();
+#ifdef _WIN32
+		m_hFile = std::exchange(rOther.m_hFile, nullptr);
+		m_hMapping = std::exchange(rOther.m_hMapping, nullptr);
+#else
+		m_iFile = std::exchange(rOther.m_iFile, -1);
+#endif
+		m_pView = std::exchange(rOther.m_pView, nullptr);
+	}
+	return *this;
+}
+
+SpillBuffer::~SpillBuffer()
+{
+	CloseFile();
+}
+
+void SpillBuffer::clear()
+{
+	CloseFile();
+	m_sMemory.clear();
+	m_uSize = 0;
+}
+
+bool SpillBuffer::reserve(uint64_t uSize)
+{
+	// the size is known from Content-Length, don't wait for the data
+	if (uSize > m_uThreshold)
+		return IsFileOpen() || Spill();
+
+	try
+	{
+		m_sMemory.reserve((size_t)uSize);
+	}
+	catch (std::bad_alloc&)
+	{
+		return false;
+	}
+	return true;
+}
+
+bool SpillBuffer::append(const char* pData, size_t uSize)
+{
+	if (!IsFileOpen() && m_uSize + uSize > m_uThreshold && !Spill())
+		return false;
+
+	m_sMemory.append(pData, uSize);
+	m_uSize += uSize;
+	if (IsFileOpen() && m_sMemory.size() >= uWriteBlockSize)
+		return Flush();
+	return true;
+}
+
+bool SpillBuffer::finish()
+{
+	if (!IsFileOpen() || m_pView)
+		return true;
+
+	if (!Flush())
+		return false;
+	std::string().swap(m_sMemory);
+
+	if (m_uSize == 0)
+		return true;
+
+#ifdef _WIN32
+	m_hMapping = CreateFileMappingW(m_hFile, nullptr, PAGE_READONLY, (DWORD)(m_uSize >> 32), (DWORD)(m_uSize & 0xFFFFFFFF), nullptr);
+	if (!m_hMapping)
+		return false;
+
+	m_pView = static_cast<const char*>(MapViewOfFile(m_hMapping, FILE_MAP_READ, 0, 0, (SIZE_T)m_uSize));
+	return m_pView != nullptr;
+#else
+	void* pView = mmap(nullptr, (size_t)m_uSize, PROT_READ, MAP_SHARED, m_iFile, 0);
+	if (pView == MAP_FAILED)
+		return false;
+
+	m_pView = static_cast<const char*>(pView);
+	return true;
+#endif
+}
+
+bool SpillBuffer::Spill()
+{
+	// the data in memory are written with the next Flush()
+#ifdef _WIN32
+	m_hFile = createTempFile();
+#else
+	m_iFile = createTempFile();
+#endif
+	return IsFileOpen();
+}
+
+bool SpillBuffer::Flush()
+{
+	const char* pData = m_sMemory.data();
+	size_t uLeft = m_sMemory.size();
+	while (uLeft > 0)
+	{
+#ifdef _WIN32
+		DWORD uWritten = 0;
+		DWORD uBlock = uLeft > 0x40000000 ? 0x40000000 : (DWORD)uLeft;
+		if (!WriteFile(m_hFile, pData, uBlock, &uWritten, nullptr))
+			return false;
+#else
+		ssize_t uWritten = write(m_iFile, pData, uLeft);
+		if (uWritten < 0 && errno == EINTR)
+			continue;
+		if (uWritten <= 0)
+			return false;
+#endif
+		pData += uWritten;
+		uLeft -= uWritten;
+	}
+	m_sMemory.clear();
+	return true;
+}
+
+bool SpillBuffer::IsFileOpen() const
+{
+#ifdef _WIN32
+	return m_hFile != nullptr;
+#else
+	return m_iFile >= 0;
+#endif
+}
+
+void SpillBuffer::CloseFile()
+{
+#ifdef _WIN32
+	if (m_pView)
+		UnmapViewOfFile(m_pView);
+	if (m_hMapping)
+		CloseHandle(m_hMapping);
+	if (m_hFile)
+		CloseHandle(m_hFile);
+	m_hMapping = nullptr;
+	m_hFile = nullptr;
+#else
+	if (m_pView)
+		munmap(const_cast<char*>(m_pView), (size_t)m_uSize);
+	if (m_iFile >= 0)
+		close(m_iFile);
+	m_iFile = -1;
+#endif
+	m_pView = nullptr;
+}
+#pragma endregion
@@ -0,0 +1,172 @@
+#pragma once
+
+// STL Header
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+
+// Boost Header
+#include <boost/asio/buffer.hpp>
+#include <boost/beast/core/error.hpp>
+#include <boost/beast/http/error.hpp>
+#include <boost/beast/http/message.hpp>
+#include <boost/optional.hpp>
+
+namespace HttpClientLite
+{
+	/**
+	 * Data of a response body. It's kept in memory until the size is over the threshold,
+	 * then moved to a temporary file which is deleted when closed, and the file is mapped read-only after completed.
+	 * view() works in the same way for both cases.
+	 */
+	class SpillBuffer
+	{
+	public:
+		static constexpr uint64_t uDefaultThreshold = 8 * 1024 * 1024;
+
+	public:
+		SpillBuffer() = default;
+		SpillBuffer(SpillBuffer&& rOther) noexcept;
+		SpillBuffer& operator=(SpillBuffer&& rOther) noexcept;
+		~SpillBuffer();
+
+		// the body may be very large, so it can be moved only
+		SpillBuffer(const SpillBuffer&) = delete;
+		SpillBuffer& operator=(const SpillBuffer&) = delete;
+
+		// should be set before the data is added
+		void SetThreshold(uint64_t uThreshold)
+		{
+			m_uThreshold = uThreshold;
+		}
+
+		// appending data over the limit fails; no limit if not set
+		void SetLimit(std::optional<uint64_t> uLimit)
+		{
+			m_uLimit = uLimit;
+		}
+
+		// the whole data; it's valid until the buffer is changed or destroyed
+		std::string_view view() const
+		{
+			return m_pView ? std::string_view(m_pView, (size_t)m_uSize) : std::string_view(m_sMemory);
+		}
+
+		uint64_t size() const
+		{
+			return m_uSize;
+		}
+
+		bool empty() const
+		{
+			return m_uSize == 0;
+		}
+
+		bool spilled() const
+		{
+			return IsFileOpen();
+		}
+
+		// used by SpillBody::reader
+		bool overLimit(uint64_t uSize) const
+		{
+			return m_uLimit && uSize > *m_uLimit;
+		}
+
+		void clear();
+		bool reserve(uint64_t uSize);
+		bool append(const char* pData, size_t uSize);
+		bool finish();
+
+	protected:
+		bool Spill();
+		bool Flush();
+		bool IsFileOpen() const;
+		void CloseFile();
+
+	protected:
+		uint64_t				m_uThreshold = uDefaultThreshold;
+		std::optional<uint64_t>	m_uLimit;
+		uint64_t				m_uSize = 0;
+
+		// the data in memory, or the data not written to file yet after spilled
+		std::string	m_sMemory;
+
+#ifdef _WIN32
+		void*		m_hFile = nullptr;
+		void*		m_hMapping = nullptr;
+#else
+		int			m_iFile = -1;
+#endif
+		const char*	m_pView = nullptr;
+	};
+
+	/**
+	 * Body type for boost::beast::http::message to read a response into SpillBuffer.
+	 * Only reading is supported.
+	 */
+	struct SpillBody
+	{
+		using value_type = SpillBuffer;
+
+		static std::uint64_t size(const value_type& rBody)
+		{
+			return rBody.size();
+		}
+
+		class reader
+		{
+		public:
+			template<bool isRequest, class Fields>
+			reader(boost::beast::http::header<isRequest, Fields>&, value_type& rBody) : m_rBody(rBody)
+			{
+			}
+
+			void init(const boost::optional<std::uint64_t>& uLength, boost::beast::error_code& ec)
+			{
+				m_rBody.clear();
+				if (uLength && m_rBody.overLimit(*uLength))
+					ec = boost::beast::http::error::body_limit;
+				else if (uLength && !m_rBody.reserve(*uLength))
+					ec = boost::beast::errc::make_error_code(boost::beast::errc::not_enough_memory);
+				else
+					ec = {};
+			}
+
+			template<class ConstBufferSequence>
+			std::size_t put(const ConstBufferSequence& rBuffers, boost::beast::error_code& ec)
+			{
+				std::size_t uSize = 0;
+				for (auto it = boost::asio::buffer_sequence_begin(rBuffers); it != boost::asio::buffer_sequence_end(rBuffers); ++it)
+				{
+					boost::asio::const_buffer mBuffer = *it;
+					if (m_rBody.overLimit(m_rBody.size() + mBuffer.size()))
+					{
+						ec = boost::beast::http::error::body_limit;
+						return uSize;
+					}
+					if (!m_rBody.append(static_cast<const char*>(mBuffer.data()), mBuffer.size()))
+					{
+						ec = boost::beast::errc::make_error_code(boost::beast::errc::io_error);
+						return uSize;
+					}
+					uSize += mBuffer.size();
+				}
+				ec = {};
+				return uSize;
+			}
+
+			void finish(boost::beast::error_code& ec)
+			{
+				if (!m_rBody.finish())
+					ec = boost::beast::errc::make_error_code(boost::beast::errc::io_error);
+				else
+					ec = {};
+			}
+
+		protected:
+			value_type&	m_rBody;
+		};
+	};
+}
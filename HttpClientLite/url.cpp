@@ -1,10 +1,14 @@
 #include "url.h"
 
+#include <charconv>
 #include <filesystem>
 
 #include <boost/tokenizer.hpp>
 #include <boost/algorithm/string/classification.hpp>
 #include <boost/algorithm/string/split.hpp>
+#include <boost/algorithm/string/join.hpp>
+#include <boost/algorithm/string/trim.hpp>
+#include <boost/algorithm/string/case_conv.hpp>
 
 #pragma region internal code
 static const std::map<std::string, uint16_t> mPortMapping = {
@@ -26,6 +30,38 @@ static bool isSpecialPort(const std::string& sProtocol, const uint16_t& uPort)
 {
 	return (getPort(sProtocol) != uPort);
 }
+
+static std::string normalizePath(const std::string& sPath)
+{
+	// remove "." and ".." segments
+	std::vector<std::string> vSegments;
+	boost::split(vSegments, sPath, boost::is_any_of("/"));
+
+	std::vector<std::string> vResult;
+	for (size_t i = 0; i < vSegments.size(); ++i)
+	{
+		const std::string& sSeg = vSegments[i];
+		if (sSeg == ".")
+			continue;
+
+		if (sSeg == "..")
+		{
+			if (vResult.size() > 1)
+				vResult.pop_back();
+			continue;
+		}
+		vResult.push_back(sSeg);
+	}
+
+	// keep the trailing slash of "dir/." and "dir/.."
+	if (vSegments.size() > 1 && (vSegments.back() == "." || vSegments.back() == ".."))
+		vResult.push_back("");
+
+	std::string sResult = boost::algorithm::join(vResult, "/");
+	if (sResult.empty() || sResult[0] != '/')
+		sResult = "/" + sResult;
+	return sResult;
+}
 #pragma endregion
 
 std::string HttpClientLite::URL::getTarget() const
@@ -46,6 +82,56 @@ std::string HttpClientLite::URL::getFilename() const
 	return std::filesystem::path(m_sPath).filename().string();
 }
 
+HttpClientLite::URL HttpClientLite::URL::resolve(const std::string& sLink) const
+{
+	std::string sTarget = boost::algorithm::trim_copy(sLink);
+
+	// remove fragment
+	size_t uPos = sTarget.find('#');
+	if (uPos != std::string::npos)
+		sTarget = sTarget.substr(0, uPos);
+
+	if (sTarget.empty())
+		return *this;
+
+	// absolute URL, or another scheme
+	uPos = sTarget.find_first_of(":/?");
+	if (uPos != std::string::npos && sTarget[uPos] == ':')
+	{
+		std::string sScheme = boost::algorithm::to_lower_copy(sTarget.substr(0, uPos));
+		if (getPort(sScheme) == 0 || sTarget.compare(uPos, 3, "://") != 0)
+			return URL();
+
+		return URL(sScheme + sTarget.substr(uPos));
+	}
+
+	// protocol-relative
+	if (sTarget.compare(0, 2, "//") == 0)
+		return URL(m_sProtocol + ":" + sTarget);
+
+	// build the path
+	std::string sQuery;
+	uPos = sTarget.find('?');
+	if (uPos != std::string::npos)
+	{
+		sQuery = sTarget.substr(uPos);
+		sTarget = sTarget.substr(0, uPos);
+	}
+
+	std::string sPath;
+	if (sTarget.empty())
+		sPath = m_sPath;
+	else if (sTarget[0] == '/')
+		sPath = normalizePath(sTarget);
+	else
+		sPath = normalizePath(m_sPath.substr(0, m_sPath.rfind('/') + 1) + sTarget);
+
+	URL mBase(*this);
+	mBase.m_sPath = "";
+	mBase.m_vGetData.clear();
+	return URL(mBase.toString() + sPath + sQuery);
+}
+
 std::string HttpClientLite::URL::toString() const
 {
 	if (!isValid())
@@ -79,6 +165,14 @@ std::string HttpClientLite::URL::toString() const
 	return sUrl;
 }
 
+std::string HttpClientLite::URL::toCanonicalString() const
+{
+	URL mURL(*this);
+	boost::algorithm::to_lower(mURL.m_sProtocol);
+	boost::algorithm::to_lower(mURL.m_sHost);
+	return mURL.toString();
+}
+
 bool HttpClientLite::URL::fromString(const std::string & sInput)
 {
 	reset();
@@ -90,8 +184,12 @@ bool HttpClientLite::URL::fromString(const std::string & sInput)
 		{
 			m_sProtocol = sInput.substr(0, uPos1);
 			m_uPort = getPort(m_sProtocol);
+			uPos1 += 3;
+		}
+		else
+		{
+			uPos1 = 0;
 		}
-		uPos1 += 3;
 	}
 
 	// login@domain:port
@@ -121,11 +219,23 @@ bool HttpClientLite::URL::fromString(const std::string & sInput)
 
 		// port
 		{
+			// the input may come from network, so a bad port makes the URL invalid instead of throwing
 			size_t uPos = sDomain.find(":");
 			if (uPos != std::string::npos)
 			{
-				m_uPort = std::stoi(sDomain.substr(uPos + 1));
+				std::string sPort = sDomain.substr(uPos + 1);
 				sDomain = sDomain.substr(0, uPos);
+				if (!sPort.empty())
+				{
+					unsigned int uPort = 0;
+					auto mResult = std::from_chars(sPort.data(), sPort.data() + sPort.size(), uPort);
+					if (mResult.ec != std::errc() || mResult.ptr != sPort.data() + sPort.size() || uPort > 65535)
+					{
+						reset();
+						return false;
+					}
+					m_uPort = (uint16_t)uPort;
+				}
 			}
 		}
 
@@ -133,6 +243,7 @@ bool HttpClientLite::URL::fromString(const std::string & sInput)
 	}
 
 	// path
+	if (uPos2 != std::string::npos)
 	{
 		m_sPath = sInput.substr(uPos2);
 
@@ -56,7 +56,16 @@ namespace HttpClientLite {
 		std::string getTarget() const;
 		std::string getFilename() const;
 
+		/**
+		 * Resolve a link found in the page of this URL (absolute, protocol-relative, absolute path or relative path).
+		 * The fragment is removed; return an invalid URL for links that can't be fetched (javascript:, mailto:, ...)
+		 */
+		URL resolve(const std::string& sLink) const;
+
 		std::string toString() const;
+
+		// the string with lower-case protocol and host, for comparing URLs
+		std::string toCanonicalString() const;
 		bool fromString(const std::string& sInput);
 	};
 }